@@ -0,0 +1,100 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include "image_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Shared driver of the filter benchmarks: each one only supplies a fill
+ * pattern and the two filters it compares. For every parameter it prints
+ * the best of three runs of both filters, on one thread and on all.
+ *
+ * Usage: <bench> [width height [channels]]
+ */
+typedef struct {
+    const char *name;               // column label, e.g. "box"
+    void (*func)(Image*, float);
+    float max_param;                // larger parameters are shown as "-"; 0 for no limit
+} BenchFilter;
+
+typedef struct {
+    const char *param_name;         // first column, e.g. "sigma"
+    const float *params;
+    int num_params;
+    BenchFilter filters[2];
+    int width;                      // default size
+    int height;
+    void (*fill)(Image*);
+} BenchSpec;
+
+// Best of three runs on fresh copies, in seconds.
+static double bench_best_time(void (*func)(Image*, float), const Image *source, float param) {
+    double best = -1.0;
+
+    for (int run = 0; run < 3; run++) {
+        Image image;
+        if (!image_clone(&image, source)) {
+            return -1.0;
+        }
+        const double t = filter_time(func, &image, param);
+        if (best < 0.0 || t < best) best = t;
+        image_free(&image);
+    }
+
+    return best;
+}
+
+static int bench_main(int argc, char *argv[], const BenchSpec *spec) {
+    const int width = (argc > 2) ? atoi(argv[1]) : spec->width;
+    const int height = (argc > 2) ? atoi(argv[2]) : spec->height;
+    const int channels = (argc > 3) ? atoi(argv[3]) : 3;
+
+    Image source;
+    if (width <= 0 || height <= 0 || channels < 1 || channels > 4 ||
+        !image_alloc(&source, width, height, channels)) {
+        fprintf(stderr, "Usage: %s [width height [channels]]\n", argv[0]);
+        return 1;
+    }
+    spec->fill(&source);
+
+    const int param_width = (strlen(spec->param_name) < 8) ? 8 : (int)strlen(spec->param_name) + 1;
+
+    printf("%dx%d, %d channels\n", width, height, channels);
+    printf("%*s", param_width, spec->param_name);
+    for (int f = 0; f < 2; f++) {
+        char label[64];
+        snprintf(label, sizeof(label), "%s 1 thread", spec->filters[f].name);
+        printf(" %14s", label);
+        snprintf(label, sizeof(label), "%s threads", spec->filters[f].name);
+        printf(" %14s", label);
+    }
+    printf("\n");
+
+    for (int i = 0; i < spec->num_params; i++) {
+        const float param = spec->params[i];
+        double times[4];
+
+        for (int threaded = 0; threaded < 2; threaded++) {
+            use_thread = threaded;
+            for (int f = 0; f < 2; f++) {
+                const BenchFilter *filter = &spec->filters[f];
+                const int skipped = filter->max_param > 0.0f && param > filter->max_param;
+                times[2 * f + threaded] = skipped ? -1.0 : bench_best_time(filter->func, &source, param);
+            }
+        }
+
+        printf("%*.1f", param_width, param);
+        for (int j = 0; j < 4; j++) {
+            if (times[j] < 0.0) printf(" %14s", "-");
+            else printf(" %14.4f", times[j]);
+        }
+        printf("\n");
+    }
+
+    image_free(&source);
+    return 0;
+}
+
+#endif //BENCH_COMMON_H
@@ -0,0 +1,29 @@
+#include "bench_common.h"
+
+/**
+ * Times gaussian_blur (three box passes, sigma 1-10) against
+ * iir_gaussian_blur (recursive, any sigma) on a synthetic image.
+ *
+ * Usage: img_ed_blur_bench [width height [channels]]
+ */
+static const float sigmas[] = {1.0f, 2.0f, 5.0f, 10.0f, 20.0f, 50.0f, 100.0f, 200.0f};
+
+static void fill(Image *image) {
+    unsigned int seed = 12345;
+    for (int y = 0; y < image->height; y++) {
+        unsigned char *row = image_row(image, y);
+        for (int i = 0; i < image->width * image->channels; i++) {
+            seed = seed * 1103515245u + 12345u;
+            row[i] = (unsigned char)(((i + y) & 0xFF) ^ (seed >> 24));
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const BenchSpec spec = {
+        "sigma", sigmas, sizeof(sigmas) / sizeof(sigmas[0]),
+        {{"box", gaussian_blur, 10.0f}, {"iir", iir_gaussian_blur, 0.0f}},
+        4000, 3000, fill
+    };
+    return bench_main(argc, argv, &spec);
+}
@@ -0,0 +1,35 @@
+#include "bench_common.h"
+
+/**
+ * Times edge_detect (Sobel threshold) against canny_edge_detect (blur,
+ * non-max suppression, hysteresis) on a synthetic 4K image.
+ *
+ * Usage: img_ed_edge_bench [width height [channels]]
+ */
+static const float thresholds[] = {20.0f, 50.0f, 100.0f, 200.0f};
+
+// Concentric rings with noise on top, so both detectors find edges of every direction.
+static void fill(Image *image) {
+    unsigned int seed = 12345;
+    for (int y = 0; y < image->height; y++) {
+        unsigned char *row = image_row(image, y);
+        const int dy = y - image->height / 2;
+        for (int x = 0; x < image->width; x++) {
+            const int dx = x - image->width / 2;
+            const int base = (((dx * dx + dy * dy) >> 11) & 1) ? 190 : 60;
+            for (int c = 0; c < image->channels; c++) {
+                seed = seed * 1103515245u + 12345u;
+                row[x * image->channels + c] = (unsigned char)(base + (int)(seed >> 27) - 16);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const BenchSpec spec = {
+        "threshold", thresholds, sizeof(thresholds) / sizeof(thresholds[0]),
+        {{"edge", edge_detect, 0.0f}, {"canny", canny_edge_detect, 0.0f}},
+        3840, 2160, fill
+    };
+    return bench_main(argc, argv, &spec);
+}
@@ -0,0 +1,32 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include "pipeline.h"
+
+typedef enum {
+    ERROR_SUCCESS = 0,
+    ERROR_IO = 1,
+    ERROR_INVALID_ARGS = 2
+} ErrorCode;
+
+void usage(const char* name);
+int validate(const char* filter_name, float value);
+
+/**
+ * Parses the filter at argv[*i] and its parameter, if it takes one, into
+ * step. On success *i points at the last consumed argument.
+ * Returns an ErrorCode; errors are reported to stderr and the log, and an
+ * unknown filter also prints usage() if show_usage is set.
+ */
+int parse_filter(int argc, char *argv[], int *i, ChainStep *step, int show_usage);
+
+int save_image(const char *path, const Image *image);
+
+// Logs how much image and scratch memory huge pages back, for --hugepage-report.
+void log_huge_pages(void);
+
+int run_batch(int argc, char *argv[]);
+int run_server(int argc, char *argv[]);
+int run_client(int argc, char *argv[]);
+
+#endif //CLI_H
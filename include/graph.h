@@ -0,0 +1,38 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "image_utils.h"
+
+#define GRAPH_SOURCE 0
+
+typedef struct FilterGraph FilterGraph;
+
+/**
+ * Lazily evaluated filter graph. Nodes are filter applications, edges are
+ * image buffers; node GRAPH_SOURCE is the input image. Nothing runs until
+ * graph_evaluate(), which only computes nodes that feed a requested output.
+ *
+ * The graph takes ownership of image (it is released with image_free()).
+ */
+FilterGraph *graph_create(Image *image);
+void graph_free(FilterGraph *graph);
+
+/**
+ * Adds filter(input) and returns its node id, or -1 on allocation failure.
+ * Adding the same filter with the same parameter to the same input returns
+ * the existing node, so common subexpressions are computed once.
+ */
+int graph_add(FilterGraph *graph, int input, const Filter *filter, float param);
+
+void graph_request(FilterGraph *graph, int node);
+
+/**
+ * Computes every requested node. Runs of nodes with a single consumer are
+ * fused through the chain planner and run in place; a buffer is released
+ * as soon as its last consumer has taken it. Returns 1 on success.
+ */
+int graph_evaluate(FilterGraph *graph);
+
+const Image *graph_output(const FilterGraph *graph, int node);
+
+#endif //GRAPH_H
@@ -1,6 +1,7 @@
 #ifndef IMAGE_UTILS_H
 #define IMAGE_UTILS_H
 
+#include <stddef.h>
 #include <stdio.h>
 
 #define JPEG_QUALITY 90
@@ -8,35 +9,250 @@
 
 #define BLOCK_SIZE 64
 
-#define CACHE_BLOCK_SIZE 32
+// Rows per band in edge detection; each band also converts the row on either side to gray.
+#define EDGE_BAND 64
+
+// Canny: the gray plane is blurred with this sigma and the low threshold is this fraction of the high one.
+#define CANNY_SIGMA 1.4f
+#define CANNY_LOW_RATIO 0.5f
+
+// tan(22.5 degrees) in Q16, the boundary between gradient direction sectors.
+#define CANNY_TAN_Q16 27146
+
+// Pixels gray_row deinterleaves at a time for the edge detector.
+#define GRAY_CHUNK 256
+
+// Byte columns per strip, and per thread, in the vertical box blur pass.
+#define PLANE_STRIP 256
+
+// Byte columns per strip in the recursive Gaussian; each thread keeps (height + 3) * IIR_STRIP doubles.
+#define IIR_STRIP 128
+
+// Pixels per side of the blocks image_transpose works in.
+#define TRANSPOSE_BLOCK 32
+
+// Below this many pixels an OpenMP fork/join costs more than the filter itself.
+#define MIN_PIXELS_PER_THREAD 10000
+#define USE_THREADS_FOR(pixels) (use_thread && (pixels) > MIN_PIXELS_PER_THREAD)
+
+// Row starts of buffers from image_alloc, in bytes; one cache line, one AVX-512 vector.
+#define IMAGE_ALIGN 64
+
+// Buffers from this size up are mapped on their own and backed by huge pages where possible.
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+#define IMAGE_OWNED 1    // image_free releases data
+#define IMAGE_ALIGNED 2  // data and stride are multiples of IMAGE_ALIGN
+#define IMAGE_PLANAR 4   // one plane per channel, plane_size bytes apart
+
+// Q12 fixed point for the colour filters when use_fixed_point is set:
+// coefficients are scaled by FIXED_ONE and every result is rounded once,
+// half up, by FIXED_ROUND, so the bytes never depend on the ISA or threads.
+#define FIXED_SHIFT 12
+#define FIXED_ONE (1 << FIXED_SHIFT)
+#define FIXED_ROUND(x) (((x) + (FIXED_ONE >> 1)) >> FIXED_SHIFT)
+
+#define GRAY_R_WEIGHT 0.299f
+#define GRAY_G_WEIGHT 0.587f
+#define GRAY_B_WEIGHT 0.114f
+
+typedef enum {
+    POINT_NONE = 0,
+    POINT_MATRIX,   // 3x4 colour matrix over RGB, built by Filter.matrix
+    POINT_INVERT,
+    POINT_BRIGHTNESS,
+    POINT_CONTRAST,
+    POINT_LUT       // composed per-channel table, produced by the chain planner
+} PointOp;
+
+/**
+ * 8-bit pixels, rows stride bytes apart. stride may exceed the row's
+ * pixel bytes: image_alloc pads rows to IMAGE_ALIGN, and a view from
+ * image_crop keeps its parent's stride. Kernels must walk rows with
+ * image_row and never assume the pixels are contiguous.
+ *
+ * Pixels are interleaved (RGBRGB...) unless IMAGE_PLANAR is set; then
+ * channel c is a separate plane starting at data + c * plane_size, and
+ * only filters with a planar implementation may run on the image.
+ */
+typedef struct {
+    unsigned char *data;
+    int width;
+    int height;
+    int channels;
+    size_t stride;
+    size_t plane_size;
+    int flags;
+} Image;
+
+static inline unsigned char *image_row(const Image *image, int y) {
+    return image->data + (size_t)y * image->stride;
+}
+
+static inline unsigned char *image_plane_row(const Image *image, int c, int y) {
+    return image->data + c * image->plane_size + (size_t)y * image->stride;
+}
+
+void *image_buffer_alloc(size_t size);
+void *image_buffer_realloc(void *data, size_t size);
+void image_buffer_free(void *data);
+
+typedef struct {
+    size_t hugetlb;     // image buffer bytes in hugetlbfs pages
+    size_t advised;     // image buffer bytes advised for transparent huge pages
+    size_t anonymous;   // the process's anonymous memory
+    size_t anon_huge;   // of which the kernel backs with transparent huge pages
+} HugePageStats;
+
+int huge_page_stats(HugePageStats *stats);
+
+void numa_place(void *data, size_t size);
+int numa_bind_threads(void);
+const char *numa_policy_name(void);
+
+int image_alloc(Image *image, int width, int height, int channels);
+int image_alloc_planar(Image *image, int width, int height, int channels);
+Image image_wrap(unsigned char *data, int width, int height, int channels, int flags);
+Image image_crop(const Image *image, int x, int y, int width, int height);
+void image_copy(Image *dst, const Image *src);
+void image_transpose(Image *dst, const Image *src);
+int image_clone(Image *dst, const Image *src);
+void image_free(Image *image);
+
+/**
+ * Per-thread scratch memory for filter temporaries. A filter takes a
+ * mark, allocates what it needs and releases back to the mark before it
+ * returns, so allocations nest like a stack. The memory is kept and grows
+ * to the thread's high-water mark, so later filters and images reuse it
+ * without allocating or faulting pages in. scratch_free returns it all.
+ * Scratch images are IMAGE_ALIGNED but not IMAGE_OWNED.
+ */
+typedef struct {
+    size_t used;
+    size_t spilled;
+    int spills;
+} ScratchMark;
+
+ScratchMark scratch_mark(void);
+void *scratch_alloc(size_t size);
+int scratch_image(Image *image, int width, int height, int channels, int planar);
+void scratch_release(ScratchMark mark);
+void scratch_free(void);
+
+typedef enum {
+    IMAGE_PNG,
+    IMAGE_JPEG
+} ImageFormat;
+
+int image_decode(Image *image, const unsigned char *data, size_t size);
+int image_encode(const Image *image, ImageFormat format, int quality, unsigned char **data, size_t *size);
 
 typedef struct {
     const char *name;
-    void (*func)(unsigned char*, int, int, int, float);
+    void (*func)(Image*, float);
     int param;
     const char *description;
     float min;
     float max;
+    PointOp point;
+    void (*matrix)(float m[3][4], float param);
+    int (*radius)(float param);
+    void (*planar)(Image*, float);  // same filter on an IMAGE_PLANAR image, or NULL
 } Filter;
 
-const char* file_format(const char* filename);
+extern Filter filter[];
+extern const int num_filters;
+
+const Filter *find_filter(const char *name);
+
+/**
+ * An input file's bytes, mapped read-only where mmap is available and read
+ * into memory otherwise. One open serves both the format sniff and
+ * stbi_load_from_memory.
+ */
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    int mapped;
+} InputFile;
+
+int input_open(InputFile *input, const char *path);
+void input_close(InputFile *input);
+
+const char* data_format(const unsigned char* data, size_t size);
 int is_valid_expression(const char* filename);
 
 double tmp_atof(const char s[]);
 int is_number(const char *str);
 
-double filter_time(void (*func)(unsigned char*, int, int, int, float),
-                   unsigned char *image, int width, int height, int channels, float param);
+double filter_time(void (*func)(Image*, float), Image *image, float param);
+
+void gaussian_blur(Image *image, float sigma);
+void edge_detect(Image *image, float threshold);
+void gaussian_blur_planar(Image *image, float sigma);
+void iir_gaussian_blur(Image *image, float sigma);
+void edge_detect_planar(Image *image, float threshold);
+void canny_edge_detect(Image *image, float threshold);
+int gaussian_blur_radius(float sigma);
+int edge_detect_radius(float threshold);
+void grayscale(Image *image, float param);
+void invert(Image *image, float param);
+void brightness(Image *image, float brightness);
+void contrast(Image *image, float factor);
+void sepia(Image *image, float param);
+void saturation(Image *image, float factor);
+void swap_rb(Image *image, float param);
+void tint(Image *image, float warmth);
+
+void grayscale_matrix(float m[3][4], float param);
+void sepia_matrix(float m[3][4], float param);
+void saturation_matrix(float m[3][4], float factor);
+void swap_rb_matrix(float m[3][4], float param);
+void tint_matrix(float m[3][4], float warmth);
+
+void color_matrix(Image *image, const float m[3][4]);
+void color_matrix_row(unsigned char *row, int width, int channels, const float m[3][4]);
+void color_matrix_planar_row(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width, const float m[3][4]);
+
+int fixed_from_float(float value);
+void color_matrix_fixed(int q[3][4], const float m[3][4]);
+void color_matrix_fixed_row(unsigned char *row, int width, int channels, const int m[3][4]);
+void color_matrix_fixed_planar_row(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width, const int m[3][4]);
+
+// Fixed-point brightness and contrast of one value; factor is fixed_from_float(param).
+static inline unsigned char brightness_fixed(int value, int factor) {
+    const int scaled = FIXED_ROUND(value * factor);
+    return (unsigned char)((scaled > 255) ? 255 : scaled);
+}
+
+static inline unsigned char contrast_fixed(int value, int factor) {
+    return (unsigned char)CLAMP(FIXED_ROUND((value - 128) * factor) + 128);
+}
+
+/**
+ * Premultiplied alpha for the RGBA neighbourhood filters. premultiply is
+ * round(value * alpha / 255) in integers; unpremultiply divides in float
+ * and is written exactly as the SIMD kernels compute it, so every path
+ * gives the same bytes. A transparent pixel has no colour and becomes 0.
+ */
+static inline unsigned char premultiply(int value, int alpha) {
+    const int t = value * alpha + 128;
+    return (unsigned char)((t + (t >> 8)) >> 8);
+}
+
+static inline unsigned char unpremultiply(int value, int alpha) {
+    if (alpha == 0) {
+        return 0;
+    }
+    const float v = (value * 255.0f) / alpha + 0.5f;
+    return (v >= 255.0f) ? 255 : (unsigned char)v;
+}
 
-void gaussian_blur(unsigned char *image, int width, int height, int channels, float sigma);
-void edge_detect(unsigned char *image, int width, int height, int channels, float threshold);
-void grayscale(unsigned char *image, int width, int height, int channels, float param);
-void invert(unsigned char *image, int width, int height, int channels, float param);
-void brightness(unsigned char *image, int width, int height, int channels, float brightness);
-void contrast(unsigned char *image, int width, int height, int channels, float factor);
-void sepia(unsigned char *image, int width, int height, int channels, float param);
+// Per thread, so callers that share the library can choose independently.
+extern _Thread_local int use_thread;
 
-extern int use_thread;
+// Colour filters called directly use the Q12 integer path; chains take it from ChainPlan.
+extern int use_fixed_point;
 
 
 #endif //IMAGE_UTILS_H
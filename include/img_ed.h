@@ -0,0 +1,104 @@
+#ifndef IMG_ED_H
+#define IMG_ED_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Embeddable image filter library. This header is the stable interface:
+ * types are opaque and functions only change in a way that keeps old
+ * callers compiling and linking. IMG_ED_API_VERSION grows when functions
+ * are added.
+ *
+ * Every function is reentrant. Images and chains are owned by the caller
+ * and carry no hidden shared state; a chain may be applied from several
+ * threads at once, an image must not be used by two calls at once.
+ */
+#define IMG_ED_API_VERSION 4
+
+typedef enum {
+    IMG_ED_OK = 0,
+    IMG_ED_ERROR_IO = 1,            // decode, encode or allocation failed
+    IMG_ED_ERROR_INVALID_ARGS = 2   // unknown filter, parameter out of range, bad pointer
+} ImgEdStatus;
+
+typedef enum {
+    IMG_ED_FORMAT_PNG = 0,
+    IMG_ED_FORMAT_JPEG = 1
+} ImgEdFormat;
+
+typedef struct ImgEdImage ImgEdImage;
+typedef struct ImgEdChain ImgEdChain;
+
+int img_ed_api_version(void);
+
+/**
+ * Decodes a PNG or JPEG held in memory. The input is not referenced after
+ * the call returns.
+ */
+ImgEdStatus img_ed_decode(const void *data, size_t size, ImgEdImage **image);
+void img_ed_image_size(const ImgEdImage *image, int *width, int *height, int *channels);
+void img_ed_image_free(ImgEdImage *image);
+
+ImgEdStatus img_ed_chain_create(ImgEdChain **chain);
+
+/**
+ * Appends a filter by its command-line name without the dashes, e.g.
+ * "blur" or "swap-rb". param is ignored by filters that take none.
+ */
+ImgEdStatus img_ed_chain_add(ImgEdChain *chain, const char *filter, float param);
+
+/**
+ * Runs neighbourhood filters in row bands, trading a little speed for extra
+ * memory that grows with image width only. Off by default.
+ */
+void img_ed_chain_set_streaming(ImgEdChain *chain, int streaming);
+
+/**
+ * Runs blur and edge detection on a copy with one plane per channel, which
+ * their kernels vectorize better. Results are identical. Off by default.
+ * Since API version 2.
+ */
+void img_ed_chain_set_planar(ImgEdChain *chain, int planar);
+
+/**
+ * Runs the colour filters (grayscale, sepia, brightness, contrast, ...) in
+ * integer fixed point. Output is then identical on every CPU and for any
+ * thread count, at the cost of slightly different rounding from the
+ * default float path. Off by default. Since API version 3.
+ */
+void img_ed_chain_set_fixed_point(ImgEdChain *chain, int fixed_point);
+
+/**
+ * Runs the chain over the image in place. When threaded is nonzero the
+ * filters use the OpenMP thread pool; pass 0 when the caller already runs
+ * one image per thread.
+ */
+ImgEdStatus img_ed_chain_apply(const ImgEdChain *chain, ImgEdImage *image, int threaded);
+void img_ed_chain_free(ImgEdChain *chain);
+
+/**
+ * Encodes into a new buffer released with img_ed_free(). quality (1-100)
+ * applies to JPEG only; 0 selects the command-line default of 90.
+ */
+ImgEdStatus img_ed_encode(const ImgEdImage *image, ImgEdFormat format, int quality,
+                          unsigned char **data, size_t *size);
+void img_ed_free(void *data);
+
+/**
+ * Filters keep their temporary buffers per thread between calls, so
+ * repeated chains and images reuse memory that is already mapped. This
+ * frees the calling thread's buffers and those of the OpenMP threads it
+ * runs filters on; call it before such a thread exits or to give the
+ * memory back early. Since API version 4.
+ */
+void img_ed_release_scratch(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //IMG_ED_H
@@ -0,0 +1,50 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+/**
+ * The SIMD row kernels, one table per instruction set. On x86 the build
+ * compiles src/kernels.c as kernels_generic, kernels_avx2 and
+ * kernels_avx512bw, and src/dispatch.c points kernels at the widest one
+ * the CPU supports before main runs. kernels_generic is the scalar code
+ * only, and elsewhere it is the single table, built with the default flags.
+ */
+typedef struct {
+    const char *isa;
+    void (*color_matrix_row)(unsigned char *row, int width, int channels, const float m[3][4]);
+    void (*color_matrix_planar_row)(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width,
+                                    const float m[3][4]);
+    void (*color_matrix_fixed_row)(unsigned char *row, int width, int channels, const int m[3][4]);
+    void (*color_matrix_fixed_planar_row)(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width,
+                                          const int m[3][4]);
+    void (*invert_row)(unsigned char *row, int width, int channels);
+    void (*brightness_row)(unsigned char *row, int size, float brightness);
+    void (*contrast_row)(unsigned char *row, int size, float factor);
+    void (*brightness_fixed_row)(unsigned char *row, int size, int factor);
+    void (*contrast_fixed_row)(unsigned char *row, int size, int factor);
+    void (*lut_apply)(unsigned char *data, int size, const unsigned char lut[256]);
+    void (*deinterleave_row)(const unsigned char *src, unsigned char *planes[4], int width, int channels);
+    void (*interleave_row)(unsigned char *const planes[4], unsigned char *dst, int width, int channels);
+    void (*premultiply_row)(const unsigned char *src, unsigned char *dst, int width);
+    void (*premultiply_planar_row)(unsigned char *const planes[4], int width);
+    void (*unpremultiply_planar_row)(unsigned char *const planes[4], int width);
+    void (*box_h_row)(const unsigned char *src, unsigned char *dst, int width, int channels, int radius);
+    void (*box_v_row)(unsigned short *acc, const unsigned char *add, const unsigned char *sub,
+                      unsigned char *out, int size, int radius, int unpremultiply);
+    void (*iir_forward_row)(const unsigned char *src, double *w, const double *w1, const double *w2,
+                            const double *w3, int n, int premultiply, const double coef[4]);
+    void (*iir_backward_row)(double *w, const double *y1, const double *y2, const double *y3,
+                             unsigned char *out, int n, int unpremultiply, const double coef[4]);
+    void (*gray_row)(const unsigned char *src, unsigned char *gray, int width, int channels);
+    void (*gray_planar_row)(unsigned char *const planes[4], unsigned char *gray, int width, int channels);
+    void (*edge_row)(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                     unsigned char *out, int width, int channels, int limit);
+    void (*canny_gradient_row)(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                               int *mag, unsigned char *dir, int width);
+    void (*canny_nms_row)(const int *above, const int *row, const int *below, const unsigned char *dir,
+                          unsigned char *map, int width, int low, int high);
+    void (*mask_row)(const unsigned char *mask, unsigned char *out, int width, int channels);
+} KernelTable;
+
+extern const KernelTable *kernels;
+
+#endif //KERNELS_H
@@ -0,0 +1,62 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "image_utils.h"
+
+#define TILE_SIZE 256
+#define STREAM_BAND_ROWS 64
+
+// Default for ChainPlan.streaming: neighbourhood stages run in row bands in
+// place instead of through a full-size output buffer, so extra memory
+// scales with width only.
+extern int use_streaming;
+
+// Default for ChainPlan.planar: segments of blur/edge and point stages run
+// on a planar (one plane per channel) copy, converted once on the way in
+// and out, so their kernels load one channel per vector.
+extern int use_planar;
+
+typedef struct {
+    const Filter *filter;
+    float param;
+} ChainStep;
+
+typedef struct {
+    PointOp op;
+    float param;
+    const float (*matrix)[4];
+    const int (*fixed)[4];   // Q12 copy of matrix in a fixed-point plan, else NULL
+    const unsigned char (*lut)[256];
+    int lut_uniform;
+} PointStep;
+
+/**
+ * One pass over the image: either a single filter applied through its own
+ * func, or a fused run of per-pixel filters (filter == NULL) applied row by
+ * row while the row is still in cache.
+ */
+typedef struct {
+    const Filter *filter;
+    float param;
+    PointStep *ops;
+    int num_ops;
+} ChainStage;
+
+typedef struct {
+    ChainStage *stages;
+    int num_stages;
+    PointStep *ops;
+    unsigned char (*luts)[4][256];
+    float (*matrices)[3][4];
+    int (*fixed_matrices)[3][4];
+    int streaming;
+    int planar;
+    int fixed_point;
+} ChainPlan;
+
+// With fixed_point the colour stages use the Q12 integer kernels (see FIXED_SHIFT).
+int chain_plan(ChainPlan *plan, const ChainStep *steps, int num_steps, int channels, int fixed_point);
+void chain_run(const ChainPlan *plan, Image *image);
+void chain_free(ChainPlan *plan);
+
+#endif //PIPELINE_H
@@ -1,6 +1,13 @@
 #ifndef STB_INCLUDE_H
 #define STB_INCLUDE_H
 
+#include "image_utils.h"
+
+// Decoded pixels come from image_buffer_alloc, so big images get huge pages and image_free releases them.
+#define STBI_MALLOC(size) image_buffer_alloc(size)
+#define STBI_REALLOC(data, size) image_buffer_realloc(data, size)
+#define STBI_FREE(data) image_buffer_free(data)
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
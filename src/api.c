@@ -0,0 +1,168 @@
+#include "img_ed.h"
+#include "pipeline.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct ImgEdImage {
+    Image image;
+};
+
+struct ImgEdChain {
+    ChainStep *steps;
+    int num_steps;
+    int capacity;
+    int streaming;
+    int planar;
+    int fixed_point;
+};
+
+int img_ed_api_version(void) {
+    return IMG_ED_API_VERSION;
+}
+
+ImgEdStatus img_ed_decode(const void *data, size_t size, ImgEdImage **image) {
+    if (!data || !image) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+
+    ImgEdImage *decoded = (ImgEdImage *)malloc(sizeof(ImgEdImage));
+    if (!decoded) {
+        return IMG_ED_ERROR_IO;
+    }
+
+    if (!image_decode(&decoded->image, (const unsigned char *)data, size)) {
+        free(decoded);
+        return IMG_ED_ERROR_IO;
+    }
+
+    *image = decoded;
+    return IMG_ED_OK;
+}
+
+void img_ed_image_size(const ImgEdImage *image, int *width, int *height, int *channels) {
+    if (width) *width = image->image.width;
+    if (height) *height = image->image.height;
+    if (channels) *channels = image->image.channels;
+}
+
+void img_ed_image_free(ImgEdImage *image) {
+    if (!image) {
+        return;
+    }
+    image_free(&image->image);
+    free(image);
+}
+
+ImgEdStatus img_ed_chain_create(ImgEdChain **chain) {
+    if (!chain) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+
+    *chain = (ImgEdChain *)calloc(1, sizeof(ImgEdChain));
+    return *chain ? IMG_ED_OK : IMG_ED_ERROR_IO;
+}
+
+ImgEdStatus img_ed_chain_add(ImgEdChain *chain, const char *filter, float param) {
+    if (!chain || !filter) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+
+    // The table is keyed by the command-line spelling.
+    char name[64];
+    if (strlen(filter) + 3 > sizeof(name)) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+    strcpy(name, "--");
+    strcat(name, filter);
+
+    const Filter *f = find_filter(name);
+    if (!f) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+    if (!f->param) {
+        param = 1.0f;
+    } else if (!(param >= f->min && param <= f->max)) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+
+    if (chain->num_steps == chain->capacity) {
+        int capacity = chain->capacity ? 2 * chain->capacity : 8;
+        ChainStep *steps = (ChainStep *)realloc(chain->steps, capacity * sizeof(ChainStep));
+        if (!steps) {
+            return IMG_ED_ERROR_IO;
+        }
+        chain->steps = steps;
+        chain->capacity = capacity;
+    }
+
+    chain->steps[chain->num_steps].filter = f;
+    chain->steps[chain->num_steps].param = param;
+    chain->num_steps++;
+    return IMG_ED_OK;
+}
+
+void img_ed_chain_set_streaming(ImgEdChain *chain, int streaming) {
+    chain->streaming = streaming != 0;
+}
+
+void img_ed_chain_set_planar(ImgEdChain *chain, int planar) {
+    chain->planar = planar != 0;
+}
+
+void img_ed_chain_set_fixed_point(ImgEdChain *chain, int fixed_point) {
+    chain->fixed_point = fixed_point != 0;
+}
+
+// Plans per call, so a chain is never written after it is built and can be shared.
+ImgEdStatus img_ed_chain_apply(const ImgEdChain *chain, ImgEdImage *image, int threaded) {
+    if (!chain || !image) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+
+    ChainPlan plan;
+    if (!chain_plan(&plan, chain->steps, chain->num_steps, image->image.channels, chain->fixed_point)) {
+        return IMG_ED_ERROR_IO;
+    }
+    plan.streaming = chain->streaming;
+    plan.planar = chain->planar;
+
+    const int saved = use_thread;
+    use_thread = threaded != 0;
+    chain_run(&plan, &image->image);
+    use_thread = saved;
+
+    chain_free(&plan);
+    return IMG_ED_OK;
+}
+
+void img_ed_chain_free(ImgEdChain *chain) {
+    if (!chain) {
+        return;
+    }
+    free(chain->steps);
+    free(chain);
+}
+
+ImgEdStatus img_ed_encode(const ImgEdImage *image, ImgEdFormat format, int quality,
+                          unsigned char **data, size_t *size) {
+    if (!image || !data || !size || quality < 0 || quality > 100 ||
+        (format != IMG_ED_FORMAT_PNG && format != IMG_ED_FORMAT_JPEG)) {
+        return IMG_ED_ERROR_INVALID_ARGS;
+    }
+
+    const ImageFormat image_format = (format == IMG_ED_FORMAT_JPEG) ? IMAGE_JPEG : IMAGE_PNG;
+    if (!image_encode(&image->image, image_format, quality ? quality : JPEG_QUALITY, data, size)) {
+        return IMG_ED_ERROR_IO;
+    }
+    return IMG_ED_OK;
+}
+
+void img_ed_free(void *data) {
+    free(data);
+}
+
+void img_ed_release_scratch(void) {
+    scratch_free();
+    #pragma omp parallel
+    scratch_free();
+}
@@ -0,0 +1,377 @@
+#include "cli.h"
+#include "stb_image.h"
+#include "logger.h"
+#include <dirent.h>
+#include <errno.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#define BATCH_SMALL_PIXELS (512 * 512)
+
+typedef struct {
+    char **paths;
+    int count;
+    int capacity;
+} PathList;
+
+static int path_list_add(PathList *list, const char *path) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? 2 * list->capacity : 64;
+        char **paths = (char **)realloc(list->paths, capacity * sizeof(char *));
+        if (!paths) return 0;
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+
+    char *copy = (char *)malloc(strlen(path) + 1);
+    if (!copy) return 0;
+    strcpy(copy, path);
+    list->paths[list->count++] = copy;
+    return 1;
+}
+
+static void path_list_free(PathList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int is_directory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static const char *base_name(const char *path) {
+    const char *base = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') base = p + 1;
+    }
+    return base;
+}
+
+static int compare_base_names(const void *a, const void *b) {
+    return strcmp(base_name(*(char * const *)a), base_name(*(char * const *)b));
+}
+
+/**
+ * Outputs are named after their input's file name, so two inputs with the
+ * same name in different directories would write the same file, and with
+ * the parallel pass which one wins would depend on scheduling. Returns 1
+ * and sets *first and *second to such a pair, 0 if every name is unique.
+ */
+static int find_duplicate_name(const PathList *list, const char **first, const char **second) {
+    if (list->count < 2) return 0;
+
+    char **sorted = (char **)malloc(list->count * sizeof(char *));
+    if (!sorted) return 0;
+    memcpy(sorted, list->paths, list->count * sizeof(char *));
+    qsort(sorted, list->count, sizeof(char *), compare_base_names);
+
+    int found = 0;
+    for (int i = 1; i < list->count && !found; i++) {
+        if (strcmp(base_name(sorted[i - 1]), base_name(sorted[i])) == 0) {
+            *first = sorted[i - 1];
+            *second = sorted[i];
+            found = 1;
+        }
+    }
+    free(sorted);
+    return found;
+}
+
+static int collect_directory(PathList *list, const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return 0;
+
+    char path[4096];
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_valid_expression(entry->d_name)) continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (!path_list_add(list, path)) {
+            closedir(dir);
+            return 0;
+        }
+    }
+    closedir(dir);
+
+    qsort(list->paths, list->count, sizeof(char *), compare_paths);
+    return 1;
+}
+
+// One path per line; blank lines and lines starting with '#' are skipped.
+static int collect_list_file(PathList *list, const char *list_path) {
+    FILE *file = fopen(list_path, "r");
+    if (!file) return 0;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        size_t len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+
+        if (!path_list_add(list, line)) {
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+/**
+ * Decodes input from file, opening it first if the schedule pass could
+ * not keep it open, and closes it. Plans are made up front for every
+ * channel count, so workers only read them.
+ */
+static int process_file(const char *input, InputFile *file, const char *output, const ChainPlan plans[5]) {
+    if (!is_valid_expression(input)) {
+        log_error("Unsupported file format: %s", input);
+        fprintf(stderr, "Error: only .png & .jpg files supported\n");
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (!file->data && !input_open(file, input)) {
+        log_error("Cannot open file: %s", input);
+        fprintf(stderr, "Error: could not open file %s\n", input);
+        return ERROR_IO;
+    }
+
+    Image image;
+    const int decoded = image_decode(&image, file->data, file->size);
+    input_close(file);
+    if (!decoded) {
+        log_error("Failed to load image %s. Reason: %s", input, stbi_failure_reason());
+        fprintf(stderr, "Error: failed to load image %s. Reason: %s\n", input, stbi_failure_reason());
+        return ERROR_IO;
+    }
+    log_info("Image loaded: %s, %dx%d, %d channels", input, image.width, image.height, image.channels);
+
+    chain_run(&plans[image.channels], &image);
+
+    int status = save_image(output, &image);
+    image_free(&image);
+    return status;
+}
+
+typedef struct {
+    int done;
+    int failed;
+    int result;
+} BatchProgress;
+
+static void report(BatchProgress *progress, int total, const char *input, const char *output, int status) {
+    progress->done++;
+    if (status == ERROR_SUCCESS) {
+        printf("[%d/%d] OK %s -> %s\n", progress->done, total, input, output);
+    } else {
+        printf("[%d/%d] FAILED %s (error %d)\n", progress->done, total, input, status);
+        progress->failed++;
+        if (status > progress->result) progress->result = status;
+    }
+}
+
+/**
+ * img_ed --batch <list|dir> --out-dir <dir> [filters...]
+ *
+ * Runs one filter chain over many images in a single process, so the
+ * OpenMP team, the log file, the parsed chain and its plans are set up
+ * once. Each output keeps the input's file name, so inputs whose names
+ * collide are rejected up front. Prints one status line per file and
+ * returns the most severe ErrorCode seen.
+ *
+ * Images below BATCH_SMALL_PIXELS are processed concurrently, one per
+ * thread with the filters running serially, since a parallel region per
+ * filter costs more than a thumbnail's work. Larger images then run one at
+ * a time with every thread working inside the image.
+ */
+int run_batch(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return ERROR_INVALID_ARGS;
+    }
+
+    const char *source = argv[2];
+    const char *out_dir = NULL;
+
+    ChainStep *steps = (ChainStep *)malloc(argc * sizeof(ChainStep));
+    if (!steps) {
+        log_error("Failed to allocate filter chain (%d entries)", argc);
+        return ERROR_IO;
+    }
+    int num_steps = 0;
+    int hugepage_report = 0;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--out-dir") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--hugepage-report") == 0) {
+            hugepage_report = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--fixed") == 0) {
+            use_fixed_point = 1;
+            continue;
+        }
+
+        int status = parse_filter(argc, argv, &i, &steps[num_steps], 1);
+        if (status != ERROR_SUCCESS) {
+            free(steps);
+            return status;
+        }
+        num_steps++;
+    }
+
+    if (!out_dir) {
+        log_error("Batch mode requires --out-dir");
+        fprintf(stderr, "Error: --batch requires --out-dir <dir>\n");
+        free(steps);
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (!is_directory(out_dir)) {
+#ifdef _WIN32
+        int made = _mkdir(out_dir) == 0;
+#else
+        int made = mkdir(out_dir, 0755) == 0;
+#endif
+        if (!made && errno != EEXIST) {
+            log_error("Cannot create output directory: %s", out_dir);
+            fprintf(stderr, "Error: could not create output directory %s\n", out_dir);
+            free(steps);
+            return ERROR_IO;
+        }
+    }
+
+    PathList inputs = {NULL, 0, 0};
+    int collected = is_directory(source) ? collect_directory(&inputs, source) : collect_list_file(&inputs, source);
+    if (!collected) {
+        log_error("Cannot read batch source: %s", source);
+        fprintf(stderr, "Error: could not read %s\n", source);
+        path_list_free(&inputs);
+        free(steps);
+        return ERROR_IO;
+    }
+
+    const char *first, *second;
+    if (find_duplicate_name(&inputs, &first, &second)) {
+        log_error("Batch inputs %s and %s would both be written to %s/%s", first, second, out_dir, base_name(first));
+        fprintf(stderr, "Error: %s and %s have the same file name and would overwrite each other in %s\n",
+                first, second, out_dir);
+        path_list_free(&inputs);
+        free(steps);
+        return ERROR_INVALID_ARGS;
+    }
+
+    int num_threads = omp_get_num_procs();
+    omp_set_num_threads(num_threads);
+    log_info("Batch of %d files from %s into %s with %d threads", inputs.count, source, out_dir, num_threads);
+    const int numa_nodes = numa_bind_threads();
+    log_info("NUMA placement: %s, threads bound to %d nodes", numa_policy_name(), numa_nodes);
+    if (use_fixed_point) {
+        log_info("Fixed-point mode: colour filters use Q%d integer arithmetic", FIXED_SHIFT);
+    }
+
+    ChainPlan plans[5];
+    for (int c = 0; c < 5; c++) {
+        if (!chain_plan(&plans[c], steps, num_steps, c, use_fixed_point)) {
+            log_error("Failed to plan filter chain of %d filters", num_steps);
+            for (int j = 0; j < c; j++) chain_free(&plans[j]);
+            path_list_free(&inputs);
+            free(steps);
+            return ERROR_IO;
+        }
+    }
+
+    char *small = (char *)calloc(inputs.count ? inputs.count : 1, 1);
+    InputFile *files = (InputFile *)calloc(inputs.count ? inputs.count : 1, sizeof(InputFile));
+    if (!small || !files) {
+        log_error("Failed to allocate batch schedule (%d files)", inputs.count);
+        free(small);
+        free(files);
+        for (int c = 0; c < 5; c++) chain_free(&plans[c]);
+        path_list_free(&inputs);
+        free(steps);
+        return ERROR_IO;
+    }
+
+    // Every input is opened once: its header picks the pass and its mapping is
+    // kept for decoding. Unreadable files count as large and fail in the serial pass.
+    int num_small = 0;
+    for (int i = 0; i < inputs.count; i++) {
+        if (!is_valid_expression(inputs.paths[i]) || !input_open(&files[i], inputs.paths[i])) continue;
+
+        int width, height, channels;
+        if (stbi_info_from_memory(files[i].data, (int)files[i].size, &width, &height, &channels) &&
+            (long long)width * height < BATCH_SMALL_PIXELS) {
+            small[i] = 1;
+            num_small++;
+        }
+
+        // a copy in memory rather than a mapping; holding every one at once could exhaust it
+        if (!files[i].mapped) input_close(&files[i]);
+    }
+    log_info("Batch schedule: %d small images across threads, %d large images one at a time",
+             num_small, inputs.count - num_small);
+
+    BatchProgress progress = {0, 0, ERROR_SUCCESS};
+
+    #pragma omp parallel
+    {
+        const int saved_use_thread = use_thread;
+        use_thread = 0;
+        char output[4096];
+
+        #pragma omp for schedule(dynamic)
+        for (int i = 0; i < inputs.count; i++) {
+            if (!small[i]) continue;
+
+            snprintf(output, sizeof(output), "%s/%s", out_dir, base_name(inputs.paths[i]));
+            int status = process_file(inputs.paths[i], &files[i], output, plans);
+
+            #pragma omp critical (batch_report)
+            report(&progress, inputs.count, inputs.paths[i], output, status);
+        }
+
+        use_thread = saved_use_thread;
+    }
+
+    char output[4096];
+    for (int i = 0; i < inputs.count; i++) {
+        if (small[i]) continue;
+
+        snprintf(output, sizeof(output), "%s/%s", out_dir, base_name(inputs.paths[i]));
+        int status = process_file(inputs.paths[i], &files[i], output, plans);
+        report(&progress, inputs.count, inputs.paths[i], output, status);
+    }
+
+    const int failed = progress.failed;
+    printf("Batch finished: %d succeeded, %d failed\n", inputs.count - failed, failed);
+    log_info("Batch finished: %d succeeded, %d failed", inputs.count - failed, failed);
+    if (hugepage_report) {
+        log_huge_pages();
+    }
+
+    for (int c = 0; c < 5; c++) {
+        chain_free(&plans[c]);
+    }
+    free(files);
+    free(small);
+    path_list_free(&inputs);
+    free(steps);
+    return progress.result;
+}
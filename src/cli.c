@@ -0,0 +1,194 @@
+#include "cli.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+void usage(const char* name) {
+    fprintf(stderr, "Usage: %s input.jpg output.jpg [--filter] [param value] [--benchmark | --stream] [--planar] [--fixed]\n", name);
+    fprintf(stderr, "       %s --batch <list.txt|dir> --out-dir <dir> [--filter] [param value] [--fixed]\n", name);
+    fprintf(stderr, "       %s --serve <socket>\n", name);
+    fprintf(stderr, "       %s --client <socket> input.jpg output.jpg [--filter] [param value] [--fixed]\n", name);
+    fprintf(stderr, "Available filters:\n");
+
+    for (int i = 0; i < num_filters; i++) {
+        if (filter[i].param) {
+            if (strcmp(filter[i].name, "--brightness") == 0) {
+                fprintf(stderr, "  %s [0.1-2.0] - %s\n", filter[i].name, filter[i].description);
+            }
+            else if (strcmp(filter[i].name, "--contrast") == 0) {
+                fprintf(stderr, "  %s [0.1-2.0] - %s\n", filter[i].name, filter[i].description);
+            }
+            else if (strcmp(filter[i].name, "--blur") == 0) {
+                fprintf(stderr, "  %s [1.0-10.0] - %s\n", filter[i].name, filter[i].description);
+            }
+            else if (strcmp(filter[i].name, "--edge") == 0) {
+                fprintf(stderr, "  %s [0.0-255.0] - %s\n", filter[i].name, filter[i].description);
+            }
+            else {
+                fprintf(stderr, "  %s [%.1f-%.1f] - %s\n", filter[i].name,
+                        filter[i].min, filter[i].max, filter[i].description);
+            }
+        } else {
+            fprintf(stderr, "  %s - %s\n", filter[i].name, filter[i].description);
+        }
+    }
+
+    fprintf(stderr, "  --save output.png - Also save the image as it is at this point of the chain\n");
+    fprintf(stderr, "  --benchmark - Compare single and multi-threaded execution\n");
+    fprintf(stderr, "  --stream - Run blur/edge in row bands to keep extra memory proportional to width\n");
+    fprintf(stderr, "  --planar - Run blur/edge on a copy split into one plane per channel\n");
+    fprintf(stderr, "  --fixed - Integer colour filters, bit-identical on every CPU and thread count\n");
+    fprintf(stderr, "  --hugepage-report - Log how much image and scratch memory huge pages back\n");
+    fprintf(stderr, "Environment: IMG_ED_KERNELS=generic|avx2|avx512bw caps the SIMD kernels picked at startup\n");
+    fprintf(stderr, "             IMG_ED_HUGE_PAGES=off|thp keeps big buffers off huge pages or off the hugetlbfs pool\n");
+    fprintf(stderr, "             IMG_ED_NUMA=off|first-touch|interleave|bind:<nodes> places big buffers on NUMA nodes;\n");
+    fprintf(stderr, "             threads are bound to nodes unless OMP_PROC_BIND/OMP_PLACES already bind them\n");
+}
+
+int validate(const char* filter_name, float value) {
+    for (int i = 0; i < num_filters; i++) {
+        if (strcmp(filter_name, filter[i].name) == 0) {
+            if (!filter[i].param) {
+                return 1;
+            }
+
+            if (strcmp(filter_name, "--brightness") == 0) {
+                if (value < filter[i].min || value > filter[i].max) {
+                    fprintf(stderr, "Error: Brightness must be between %.1f and %.1f.\n",
+                            filter[i].min, filter[i].max);
+                    return 0;
+                }
+            }
+            else if (strcmp(filter_name, "--contrast") == 0) {
+                if (value < filter[i].min || value > filter[i].max) {
+                    fprintf(stderr, "Error: Contrast must be between %.1f and %.1f.\n",
+                            filter[i].min, filter[i].max);
+                    return 0;
+                }
+            }
+            else if (strcmp(filter_name, "--blur") == 0 || strcmp(filter_name, "--iir-blur") == 0) {
+                if (value < filter[i].min || value > filter[i].max) {
+                    fprintf(stderr, "Error: Sigma must be between %.1f and %.1f\n",
+                            filter[i].min, filter[i].max);
+                    return 0;
+                }
+            }
+            else if (strcmp(filter_name, "--edge") == 0 || strcmp(filter_name, "--canny") == 0) {
+                if (value < filter[i].min || value > filter[i].max) {
+                    fprintf(stderr, "Error: Threshold must be between %.1f and %.1f.\n",
+                            filter[i].min, filter[i].max);
+                    return 0;
+                }
+            }
+            else if (value < filter[i].min || value > filter[i].max) {
+                fprintf(stderr, "Error: %s must be between %.1f and %.1f.\n",
+                        filter_name + 2, filter[i].min, filter[i].max);
+                return 0;
+            }
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int parse_filter(int argc, char *argv[], int *i, ChainStep *step, int show_usage) {
+    const Filter *f = find_filter(argv[*i]);
+    if (!f) {
+        log_error("Unknown filter: %s", argv[*i]);
+        fprintf(stderr, "Error: Unknown filter: %s\n", argv[*i]);
+        if (show_usage) usage(argv[0]);
+        return ERROR_INVALID_ARGS;
+    }
+
+    float param = 1.0f;
+
+    if (f->param) {
+        if (*i + 1 >= argc || !is_number(argv[*i + 1])) {
+            log_error("Filter %s requires a numeric parameter", f->name);
+            fprintf(stderr, "Error: %s requires a numeric parameter\n", f->name);
+            return ERROR_INVALID_ARGS;
+        }
+
+        param = tmp_atof(argv[*i + 1]);
+
+        if (!validate(f->name, param)) {
+            log_error("Invalid parameter value %.2f for filter %s", param, f->name);
+            return ERROR_INVALID_ARGS;
+        }
+
+        log_info("Applying filter %s with parameter %.2f", f->name, param);
+        (*i)++;
+    } else {
+        log_info("Applying filter %s", f->name);
+    }
+
+    step->filter = f;
+    step->param = param;
+    return ERROR_SUCCESS;
+}
+
+static int write_file(const char *path, const unsigned char *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return 0;
+    }
+
+    const int ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+int save_image(const char *path, const Image *image) {
+    log_info("Saving result to file: %s", path);
+    const char *ext = strrchr(path, '.');
+    if (ext == NULL) {
+        log_error("Output file has no extension: %s", path);
+        fprintf(stderr, "Error: output file has no extension\n");
+        return ERROR_INVALID_ARGS;
+    }
+
+    ImageFormat format;
+    const char *name;
+    if (strstr(ext, ".jpg") || strstr(ext, ".jpeg")) {
+        log_debug("Saving in JPEG format with quality %d", JPEG_QUALITY);
+        format = IMAGE_JPEG;
+        name = "JPEG";
+    } else if (strstr(ext, ".png")) {
+        log_debug("Saving in PNG format");
+        format = IMAGE_PNG;
+        name = "PNG";
+    } else {
+        log_info("File successfully saved: %s", path);
+        return ERROR_SUCCESS;
+    }
+
+    unsigned char *data = NULL;
+    size_t size;
+    const int written = image_encode(image, format, JPEG_QUALITY, &data, &size) && write_file(path, data, size);
+    free(data);
+
+    if (!written) {
+        log_error("Failed to write %s file: %s", name, path);
+        fprintf(stderr, "Error: failed to write %s file %s\n", name, path);
+        return ERROR_IO;
+    }
+
+    log_info("File successfully saved: %s", path);
+    return ERROR_SUCCESS;
+}
+
+void log_huge_pages(void) {
+    HugePageStats stats;
+    if (!huge_page_stats(&stats)) {
+        log_info("Huge pages: %zu MiB of buffers from hugetlbfs, %zu MiB advised for THP; no kernel report",
+                 stats.hugetlb >> 20, stats.advised >> 20);
+        return;
+    }
+
+    log_info("Huge pages: %zu MiB of buffers from hugetlbfs, %zu MiB advised for THP, "
+             "%zu of %zu MiB resident anonymous memory in THP (%.0f%%)",
+             stats.hugetlb >> 20, stats.advised >> 20, stats.anon_huge >> 20, stats.anonymous >> 20,
+             stats.anonymous ? 100.0 * stats.anon_huge / stats.anonymous : 0.0);
+}
@@ -0,0 +1,88 @@
+#include "image_utils.h"
+#include "stb_include.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+int image_decode(Image *image, const unsigned char *data, size_t size) {
+    if (size > INT_MAX) {
+        return 0;
+    }
+
+    int width, height, channels;
+    unsigned char *pixels = stbi_load_from_memory(data, (int)size, &width, &height, &channels, 0);
+    if (!pixels) {
+        return 0;
+    }
+
+    *image = image_wrap(pixels, width, height, channels, IMAGE_OWNED);
+    return 1;
+}
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} EncodeBuffer;
+
+static void encode_write(void *context, void *data, int size) {
+    EncodeBuffer *buffer = (EncodeBuffer *)context;
+    if (buffer->failed) return;
+
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? 2 * buffer->capacity : 64 * 1024;
+        while (capacity < buffer->size + size) capacity *= 2;
+
+        unsigned char *grown = (unsigned char *)realloc(buffer->data, capacity);
+        if (!grown) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+/**
+ * Encodes into a malloc'd buffer the caller frees. quality applies to JPEG
+ * only. stbi_write_jpg has no stride parameter, so padded rows are packed
+ * into a copy first.
+ */
+int image_encode(const Image *image, ImageFormat format, int quality, unsigned char **data, size_t *size) {
+    EncodeBuffer buffer = {NULL, 0, 0, 0};
+    int ok;
+
+    if (format == IMAGE_PNG) {
+        ok = stbi_write_png_to_func(encode_write, &buffer, image->width, image->height, image->channels,
+                                    image->data, (int)image->stride);
+    } else if (image->stride == (size_t)image->width * image->channels) {
+        ok = stbi_write_jpg_to_func(encode_write, &buffer, image->width, image->height, image->channels,
+                                    image->data, quality);
+    } else {
+        const ScratchMark mark = scratch_mark();
+        unsigned char *packed = (unsigned char *)scratch_alloc((size_t)image->width * image->height * image->channels);
+        if (!packed) {
+            scratch_release(mark);
+            return 0;
+        }
+
+        Image view = image_wrap(packed, image->width, image->height, image->channels, 0);
+        image_copy(&view, image);
+        ok = stbi_write_jpg_to_func(encode_write, &buffer, image->width, image->height, image->channels,
+                                    packed, quality);
+        scratch_release(mark);
+    }
+
+    if (!ok || buffer.failed) {
+        free(buffer.data);
+        return 0;
+    }
+
+    *data = buffer.data;
+    *size = buffer.size;
+    return 1;
+}
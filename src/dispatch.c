@@ -0,0 +1,52 @@
+#include "kernels.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef IMG_ED_KERNEL_VARIANTS
+
+extern const KernelTable kernels_generic;
+extern const KernelTable kernels_avx2;
+extern const KernelTable kernels_avx512bw;
+
+const KernelTable *kernels = &kernels_generic;
+
+/**
+ * Runs before main, or when the shared library is loaded, so kernels is
+ * never written once filters run. __builtin_cpu_supports also checks that
+ * the OS saves the AVX registers. IMG_ED_KERNELS=generic|avx2|avx512bw caps
+ * the choice, to compare variants on one machine.
+ */
+__attribute__((constructor))
+static void select_kernels(void) {
+    __builtin_cpu_init();
+
+    const KernelTable *variants[] = {&kernels_avx512bw, &kernels_avx2, &kernels_generic};
+    const int supported[] = {
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"),
+        __builtin_cpu_supports("avx2"),
+        1
+    };
+    const int num_variants = sizeof(variants) / sizeof(variants[0]);
+
+    const char *cap = getenv("IMG_ED_KERNELS");
+    int allowed = 1;
+    for (int i = 0; cap && i < num_variants; i++) {
+        if (strcmp(cap, variants[i]->isa) == 0) allowed = 0;
+    }
+
+    for (int i = 0; i < num_variants; i++) {
+        if (cap && strcmp(cap, variants[i]->isa) == 0) allowed = 1;
+        if (allowed && supported[i]) {
+            kernels = variants[i];
+            return;
+        }
+    }
+}
+
+#else
+
+extern const KernelTable kernels_generic;
+
+const KernelTable *kernels = &kernels_generic;
+
+#endif
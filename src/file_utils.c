@@ -1,25 +1,98 @@
 #include "image_utils.h"
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-const char* file_format(const char* filename) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) return "Unknown";
-
-    unsigned char header[8];
-    fread(header, 1, 8, file);
-    fclose(file);
-
-    if (header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF) {
+const char* data_format(const unsigned char* data, size_t size) {
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
         return "JPEG";
     }
 
-    if (memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0 ){
+    if (size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0 ){
         return "PNG";
     }
 
     return "Unknown";
 }
 
+#ifndef _WIN32
+int input_open(InputFile* input, const char* path) {
+    input->data = NULL;
+    input->size = 0;
+    input->mapped = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return 0;
+    }
+
+    // The mapping keeps its own reference to the file, so the descriptor can go now.
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+
+    posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    input->data = (const unsigned char*)data;
+    input->size = (size_t)st.st_size;
+    input->mapped = 1;
+    return 1;
+}
+#else
+int input_open(InputFile* input, const char* path) {
+    input->data = NULL;
+    input->size = 0;
+    input->mapped = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char* data = (length > 0 && length <= INT_MAX) ? (unsigned char*)malloc(length) : NULL;
+    if (!data || fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    input->data = data;
+    input->size = (size_t)length;
+    return 1;
+}
+#endif
+
+void input_close(InputFile* input) {
+    if (!input->data) return;
+
+#ifndef _WIN32
+    if (input->mapped) {
+        munmap((void*)input->data, input->size);
+    } else {
+        free((void*)input->data);
+    }
+#else
+    free((void*)input->data);
+#endif
+
+    input->data = NULL;
+    input->size = 0;
+    input->mapped = 0;
+}
+
 int is_valid_expression(const char* filename) {
     const char *ext = strrchr(filename, '.');
     if (!ext) return 0;
@@ -1,16 +1,17 @@
 #include "image_utils.h"
+#include "kernels.h"
 #include <stdio.h>
 #include <math.h>
 #include <omp.h>
 #include <stdlib.h>
 #include <string.h>
 
-int use_thread = 1;
+_Thread_local int use_thread = 1;
+int use_fixed_point = 0;
 
-double filter_time(void (*func)(unsigned char*, int, int, int, float),
-                   unsigned char *image, int width, int height, int channels, float param) {
+double filter_time(void (*func)(Image*, float), Image *image, float param) {
     double start_time = omp_get_wtime();
-    func(image, width, height, channels, param);
+    func(image, param);
     double end_time = omp_get_wtime();
     return end_time - start_time;
 }
@@ -31,651 +32,988 @@ static void box_radii(int boxes[3], float sigma) {
     for(int i = 0; i < n; i++) boxes[i] = (boxes[i] - 1) / 2;
 }
 
-static void box_h_blur(unsigned char *src, unsigned char *dst, int width, int height, int channels, int radius) {
-    float iarr = 1.0f / (radius + radius + 1);
+static void box_h_blur(const Image *src_image, Image *dst_image, int radius) {
+    const int width = src_image->width;
+    const int height = src_image->height;
+    const int channels = src_image->channels;
 
-    if (use_thread) {
+    if (USE_THREADS_FOR(width * height)) {
         #pragma omp parallel for schedule(static)
         for (int y = 0; y < height; y++) {
-            float val_r, val_g, val_b;
-            int row_offset = y * width * channels;
+            kernels->box_h_row(image_row(src_image, y), image_row(dst_image, y), width, channels, radius);
+        }
+    } else {
+        for (int y = 0; y < height; y++) {
+            kernels->box_h_row(image_row(src_image, y), image_row(dst_image, y), width, channels, radius);
+        }
+    }
+}
 
-            val_r = src[row_offset] * (radius + 1);
-            val_g = src[row_offset + 1] * (radius + 1);
-            val_b = src[row_offset + 2] * (radius + 1);
+/**
+ * Vertical box pass over byte columns [x0, x1) of interleaved rows or of
+ * one plane. It keeps one running sum per column in acc and updates a
+ * whole row of sums per output row (kernels->box_v_row), so memory is swept
+ * row by row instead of a column at a time. With unpremultiply_dst the rows
+ * are premultiplied RGBA, dst holds the original pixels and x0 must be a
+ * multiple of 4.
+ */
+static void box_v_blur_rows(const unsigned char *src, unsigned char *dst, size_t src_stride, size_t dst_stride,
+                            int height, int radius, int unpremultiply_dst, unsigned short *acc, int x0, int x1) {
+    const unsigned char *first = src;
+    const unsigned char *last = src + (size_t)(height - 1) * src_stride;
+
+    for (int x = x0; x < x1; x++) {
+        acc[x] = first[x] * (radius + 1);
+    }
 
-            for (int x = 0; x < radius; x++) {
-                val_r += src[(row_offset + x * channels)];
-                val_g += src[(row_offset + x * channels) + 1];
-                val_b += src[(row_offset + x * channels) + 2];
-            }
+    for (int y = 0; y < radius; y++) {
+        const unsigned char *row = src + (size_t)((y < height) ? y : height - 1) * src_stride;
+        for (int x = x0; x < x1; x++) {
+            acc[x] += row[x];
+        }
+    }
 
-            for (int x = 0; x <= radius; x++) {
-                val_r += src[(row_offset + (x + radius) * channels)] - src[row_offset];
-                val_g += src[(row_offset + (x + radius) * channels) + 1] - src[row_offset + 1];
-                val_b += src[(row_offset + (x + radius) * channels) + 2] - src[row_offset + 2];
+    for (int y = 0; y < height; y++) {
+        const unsigned char *add = (y + radius < height) ? src + (size_t)(y + radius) * src_stride : last;
+        const unsigned char *sub = (y > radius) ? src + (size_t)(y - radius - 1) * src_stride : first;
 
-                dst[(row_offset + x * channels)] = (unsigned char)(val_r * iarr);
-                dst[(row_offset + x * channels) + 1] = (unsigned char)(val_g * iarr);
-                dst[(row_offset + x * channels) + 2] = (unsigned char)(val_b * iarr);
-            }
+        kernels->box_v_row(acc + x0, add + x0, sub + x0, dst + (size_t)y * dst_stride + x0,
+                           x1 - x0, radius, unpremultiply_dst);
+    }
+}
 
-            for (int x = radius + 1; x < width - radius; x++) {
-                val_r += src[(row_offset + (x + radius) * channels)] - src[(row_offset + (x - radius - 1) * channels)];
-                val_g += src[(row_offset + (x + radius) * channels) + 1] - src[(row_offset + (x - radius - 1) * channels) + 1];
-                val_b += src[(row_offset + (x + radius) * channels) + 2] - src[(row_offset + (x - radius - 1) * channels) + 2];
+/**
+ * Vertical box pass. Rather than walking one column at a time, a full row
+ * stride per access, it sweeps strips of PLANE_STRIP bytes row by row (see
+ * box_v_blur_rows), so memory is read sequentially.
+ */
+static void box_v_blur(const Image *src_image, Image *dst_image, int radius, int unpremultiply_dst, unsigned short *acc) {
+    const int width = src_image->width;
+    const int height = src_image->height;
+    const int row_size = width * src_image->channels;
+    const int num_strips = (row_size + PLANE_STRIP - 1) / PLANE_STRIP;
+
+    if (USE_THREADS_FOR(width * height)) {
+        #pragma omp parallel for schedule(static)
+        for (int s = 0; s < num_strips; s++) {
+            const int x0 = s * PLANE_STRIP;
+            const int x1 = (x0 + PLANE_STRIP < row_size) ? x0 + PLANE_STRIP : row_size;
+            box_v_blur_rows(src_image->data, dst_image->data, src_image->stride, dst_image->stride,
+                            height, radius, unpremultiply_dst, acc, x0, x1);
+        }
+    } else {
+        box_v_blur_rows(src_image->data, dst_image->data, src_image->stride, dst_image->stride,
+                        height, radius, unpremultiply_dst, acc, 0, row_size);
+    }
+}
 
-                dst[(row_offset + x * channels)] = (unsigned char)(val_r * iarr);
-                dst[(row_offset + x * channels) + 1] = (unsigned char)(val_g * iarr);
-                dst[(row_offset + x * channels) + 2] = (unsigned char)(val_b * iarr);
-            }
+// dst = src with colour multiplied by alpha; both interleaved RGBA.
+static void premultiply_image(Image *dst, const Image *src) {
+    if (USE_THREADS_FOR(src->width * src->height)) {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < src->height; y++) {
+            kernels->premultiply_row(image_row(src, y), image_row(dst, y), src->width);
+        }
+    } else {
+        for (int y = 0; y < src->height; y++) {
+            kernels->premultiply_row(image_row(src, y), image_row(dst, y), src->width);
+        }
+    }
+}
 
-            for (int x = width - radius; x < width; x++) {
-                val_r += src[(row_offset + (width - 1) * channels)] - src[(row_offset + (x - radius -1) * channels)];
-                val_g += src[(row_offset + (width - 1) * channels) + 1] - src[(row_offset + (x - radius -1) * channels) + 1];
-                val_b += src[(row_offset + (width - 1) * channels) + 2] - src[(row_offset + (x - radius -1) * channels) + 2];
+/**
+ * Three box passes alternating between buffer and temp; the last vertical
+ * pass writes the image. RGBA is blurred premultiplied so transparent
+ * pixels do not darken or tint their neighbours: the copy into buffer
+ * premultiplies, the last pass divides by the blurred alpha, and the
+ * image keeps its own alpha.
+ */
+void gaussian_blur(Image *image, float sigma) {
+    if (sigma < 1 || sigma > 10.0f) {
+        fprintf(stderr, "Error: Sigma must be between 1 and 10\n");
+        return;
+    }
 
-                dst[(row_offset + x * channels)] = (unsigned char)(val_r * iarr);
-                dst[(row_offset + x * channels) + 1] = (unsigned char)(val_g * iarr);
-                dst[(row_offset + x * channels) + 2] = (unsigned char)(val_b * iarr);
-            }
+    int boxes[3];
+    box_radii(boxes, sigma);
 
-            if (channels == 4) {
-                for (int x = 0; x < width; x++) dst[(row_offset + x * channels) + 3] = src[(row_offset + x * channels) + 3];
-            }
-        }
+    const ScratchMark mark = scratch_mark();
+    Image temp;
+    Image buffer;
+    unsigned short *acc = (unsigned short *)scratch_alloc((size_t)image->width * image->channels * sizeof(unsigned short));
+    const int have_temp = scratch_image(&temp, image->width, image->height, image->channels, 0);
+    const int have_buffer = scratch_image(&buffer, image->width, image->height, image->channels, 0);
+
+    if (!have_temp || !have_buffer || !acc) {
+        fprintf(stderr, "Error: Failed tp allocate temporary buffer\n");
+        scratch_release(mark);
+        return;
     }
-    else {
-        for (int y = 0; y < height; y++) {
-            float val_r, val_g, val_b;
-            int row_offset = y * width * channels;
 
-            val_r = src[row_offset] * (radius + 1);
-            val_g = src[row_offset + 1] * (radius + 1);
-            val_b = src[row_offset + 2] * (radius + 1);
+    const int premultiplied = image->channels == 4;
+    if (premultiplied) {
+        premultiply_image(&buffer, image);
+    } else {
+        image_copy(&buffer, image);
+    }
 
-            for (int x = 0; x < radius; x++) {
-                val_r += src[(row_offset + x * channels)];
-                val_g += src[(row_offset + x * channels) + 1];
-                val_b += src[(row_offset + x * channels) + 2];
-            }
+    for (int i = 0; i < 3; i++) {
+        box_h_blur(&buffer, &temp, boxes[i]);
+        if (i < 2) {
+            box_v_blur(&temp, &buffer, boxes[i], 0, acc);
+        } else {
+            box_v_blur(&temp, image, boxes[i], premultiplied, acc);
+        }
+    }
 
-            for (int x = 0; x <= radius; x++) {
-                val_r += src[(row_offset + (x + radius) * channels)] - src[row_offset];
-                val_g += src[(row_offset + (x + radius) * channels) + 1] - src[row_offset + 1];
-                val_b += src[(row_offset + (x + radius) * channels) + 2] - src[row_offset + 2];
+    scratch_release(mark);
+}
 
-                dst[(row_offset + x * channels)] = (unsigned char)(val_r * iarr);
-                dst[(row_offset + x * channels) + 1] = (unsigned char)(val_g * iarr);
-                dst[(row_offset + x * channels) + 2] = (unsigned char)(val_b * iarr);
-            }
+// Three box passes over one plane in place, temp being a scratch plane.
+static void box_blur_plane(unsigned char *plane, size_t stride, Image *temp, const int boxes[3], unsigned short *acc) {
+    const int width = temp->width;
+    const int height = temp->height;
+    const int num_strips = (width + PLANE_STRIP - 1) / PLANE_STRIP;
 
-            for (int x = radius + 1; x < width - radius; x++) {
-                val_r += src[(row_offset + (x + radius) * channels)] - src[(row_offset + (x - radius - 1) * channels)];
-                val_g += src[(row_offset + (x + radius) * channels) + 1] - src[(row_offset + (x - radius - 1) * channels) + 1];
-                val_b += src[(row_offset + (x + radius) * channels) + 2] - src[(row_offset + (x - radius - 1) * channels) + 2];
+    for (int i = 0; i < 3; i++) {
+        const int radius = boxes[i];
 
-                dst[(row_offset + x * channels)] = (unsigned char)(val_r * iarr);
-                dst[(row_offset + x * channels) + 1] = (unsigned char)(val_g * iarr);
-                dst[(row_offset + x * channels) + 2] = (unsigned char)(val_b * iarr);
+        if (USE_THREADS_FOR(width * height)) {
+            #pragma omp parallel for schedule(static)
+            for (int y = 0; y < height; y++) {
+                kernels->box_h_row(plane + (size_t)y * stride, image_row(temp, y), width, 1, radius);
             }
 
-            for (int x = width - radius; x < width; x++) {
-                val_r += src[(row_offset + (width - 1) * channels)] - src[(row_offset + (x - radius -1) * channels)];
-                val_g += src[(row_offset + (width - 1) * channels) + 1] - src[(row_offset + (x - radius -1) * channels) + 1];
-                val_b += src[(row_offset + (width - 1) * channels) + 2] - src[(row_offset + (x - radius -1) * channels) + 2];
-
-                dst[(row_offset + x * channels)] = (unsigned char)(val_r * iarr);
-                dst[(row_offset + x * channels) + 1] = (unsigned char)(val_g * iarr);
-                dst[(row_offset + x * channels) + 2] = (unsigned char)(val_b * iarr);
+            #pragma omp parallel for schedule(static)
+            for (int s = 0; s < num_strips; s++) {
+                const int x0 = s * PLANE_STRIP;
+                const int x1 = (x0 + PLANE_STRIP < width) ? x0 + PLANE_STRIP : width;
+                box_v_blur_rows(temp->data, plane, temp->stride, stride, height, radius, 0, acc, x0, x1);
             }
-
-            if (channels == 4) {
-                for (int x = 0; x < width; x++) dst[(row_offset + x * channels) + 3] = src[(row_offset + x * channels) + 3];
+        } else {
+            for (int y = 0; y < height; y++) {
+                kernels->box_h_row(plane + (size_t)y * stride, image_row(temp, y), width, 1, radius);
             }
+            box_v_blur_rows(temp->data, plane, temp->stride, stride, height, radius, 0, acc, 0, width);
         }
     }
 }
 
-static void box_v_blur(unsigned char *src, unsigned char *dst, int width, int height, int channels, int radius) {
-    float iarr = 1.0f / (radius + radius + 1);
+/*
+ * Planar RGBA row y: the colour planes are multiplied by alpha_plane,
+ * which is first filled with the image's alpha, or with divide set
+ * divided by it.
+ */
+static void planar_alpha_row(Image *image, Image *alpha_plane, int y, int divide) {
+    unsigned char *const planes[4] = {image_plane_row(image, 0, y), image_plane_row(image, 1, y),
+                                      image_plane_row(image, 2, y), image_row(alpha_plane, y)};
+    if (divide) {
+        kernels->unpremultiply_planar_row(planes, image->width);
+    } else {
+        memcpy(planes[3], image_plane_row(image, 3, y), image->width);
+        kernels->premultiply_planar_row(planes, image->width);
+    }
+}
 
-    if (use_thread) {
+static void planar_alpha(Image *image, Image *alpha_plane, int divide) {
+    if (USE_THREADS_FOR(image->width * image->height)) {
         #pragma omp parallel for schedule(static)
-        for (int x = 0; x < width; x++) {
+        for (int y = 0; y < image->height; y++) {
+            planar_alpha_row(image, alpha_plane, y, divide);
+        }
+    } else {
+        for (int y = 0; y < image->height; y++) {
+            planar_alpha_row(image, alpha_plane, y, divide);
+        }
+    }
+}
 
-            float val_r, val_g, val_b;
-            int col_offset = x * channels;
+/**
+ * gaussian_blur on an IMAGE_PLANAR image, one plane at a time with a
+ * single scratch plane instead of two full interleaved copies. RGBA is
+ * premultiplied like in gaussian_blur: a copy of the alpha plane is
+ * blurred with the colour and divided out at the end, so the results are
+ * the same and alpha is left as it is.
+ */
+void gaussian_blur_planar(Image *image, float sigma) {
+    if (sigma < 1 || sigma > 10.0f) {
+        fprintf(stderr, "Error: Sigma must be between 1 and 10\n");
+        return;
+    }
 
-            val_r = src[col_offset] * (radius + 1);
-            val_g = src[col_offset + 1] * (radius + 1);
-            val_b = src[col_offset + 2] * (radius + 1);
+    const int width = image->width;
+    const int height = image->height;
+    const int planes = (image->channels < 3) ? image->channels : 3;
+    const int premultiplied = image->channels == 4;
 
-            for (int y = 0; y < radius; y++) {
-                val_r += src[(y * width + x) * channels];
-                val_g += src[(y * width + x) * channels + 1];
-                val_b += src[(y * width + x) * channels + 2];
-            }
+    int boxes[3];
+    box_radii(boxes, sigma);
 
-            for (int y = 0; y <= radius; y++) {
-                val_r += src[((y + radius) * width + x) * channels] - src[col_offset];
-                val_g += src[((y + radius) * width + x) * channels + 1] - src[col_offset + 1];
-                val_b += src[((y + radius) * width + x) * channels + 2] - src[col_offset + 2];
+    const ScratchMark mark = scratch_mark();
+    Image temp;
+    Image alpha_plane;
+    unsigned short *acc = (unsigned short *)scratch_alloc((size_t)width * sizeof(unsigned short));
+    const int have_temp = scratch_image(&temp, width, height, 1, 1);
+    const int have_alpha = !premultiplied || scratch_image(&alpha_plane, width, height, 1, 1);
 
-                dst[(y * width + x) * channels] = (unsigned char)(val_r * iarr);
-                dst[(y * width + x) * channels + 1] = (unsigned char)(val_g * iarr);
-                dst[(y * width + x) * channels + 2] = (unsigned char)(val_b * iarr);
-            }
+    if (!have_temp || !have_alpha || !acc) {
+        fprintf(stderr, "Error: Failed to allocate temporary buffer\n");
+        scratch_release(mark);
+        return;
+    }
 
-            for (int y = radius + 1; y < height - radius; y++) {
-                val_r += src[((y + radius) * width + x) * channels] - src[((y - radius - 1) * width + x) * channels];
-                val_g += src[((y + radius) * width + x) * channels + 1] - src[((y - radius - 1) * width + x) * channels + 1];
-                val_b += src[((y + radius) * width + x) * channels + 2] - src[((y - radius - 1) * width + x) * channels + 2];
+    if (premultiplied) {
+        planar_alpha(image, &alpha_plane, 0);
+        box_blur_plane(alpha_plane.data, alpha_plane.stride, &temp, boxes, acc);
+    }
 
-                dst[(y * width + x) * channels] = (unsigned char)(val_r * iarr);
-                dst[(y * width + x) * channels + 1] = (unsigned char)(val_g * iarr);
-                dst[(y * width + x) * channels + 2] = (unsigned char)(val_b * iarr);
-            }
+    for (int c = 0; c < planes; c++) {
+        box_blur_plane(image->data + c * image->plane_size, image->stride, &temp, boxes, acc);
+    }
 
-            for (int y = height - radius; y < height; y++) {
-                val_r += src[((height - 1) * width + x) * channels] - src[((y - radius - 1) * width + x) * channels];
-                val_g += src[((height - 1) * width + x) * channels + 1] - src[((y - radius - 1) * width + x) * channels + 1];
-                val_b += src[((height - 1) * width + x) * channels + 2] - src[((y - radius - 1) * width + x) * channels + 2];
+    if (premultiplied) {
+        planar_alpha(image, &alpha_plane, 1);
+    }
 
-                dst[(y * width + x) * channels] = (unsigned char)(val_r * iarr);
-                dst[(y * width + x) * channels + 1] = (unsigned char)(val_g * iarr);
-                dst[(y * width + x) * channels + 2] = (unsigned char)(val_b * iarr);
-            }
+    scratch_release(mark);
+}
 
-            if (channels == 4) {
-                for (int y = 0; y < height; y++) {
-                    dst[(y * width + x) * channels + 3] = src[(y * width + x) * channels + 3];
-                }
-            }
-        }
-    } else {
-        for (int x = 0; x < width; x++) {
+typedef struct {
+    double coef[4];    // {B, b1, b2, b3} divided by b0
+    double edge[3][3]; // last three forward values -> first three backward ones, see iir_filter
+} IirFilter;
+
+/**
+ * Young & van Vliet's third-order recursive Gaussian. B is taken as
+ * 1 - (b1 + b2 + b3) so a flat image stays exactly flat.
+ *
+ * The backward pass needs the three values past the end of a column. For
+ * an edge that repeats the last pixel u they are u + edge * (w - u), w
+ * being the last three forward values (Triggs & Sdika). edge is found by
+ * running each unit deviation of w through the rest of the forward pass
+ * and back, which only costs O(sigma) once per call.
+ */
+static int iir_filter(IirFilter *f, float sigma) {
+    const double q = (sigma >= 2.5f) ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    const double q2 = q * q;
+    const double q3 = q2 * q;
+    double *c = f->coef;
+
+    const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    c[1] = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    c[2] = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    c[3] = 0.422205 * q3 / b0;
+    c[0] = 1.0 - (c[1] + c[2] + c[3]);
+
+    const int n = (int)(10.0f * sigma) + 100;
+    double *w = (double *)calloc(2 * (n + 6), sizeof(double));
+    if (!w) {
+        return 0;
+    }
+    double *y = w + n + 6;
 
-            float val_r, val_g, val_b;
-            int col_offset = x * channels;
+    for (int j = 0; j < 3; j++) {
+        memset(w, 0, 2 * (n + 6) * sizeof(double));
+        w[2 - j] = 1.0;
 
-            val_r = src[col_offset] * (radius + 1);
-            val_g = src[col_offset + 1] * (radius + 1);
-            val_b = src[col_offset + 2] * (radius + 1);
+        for (int i = 3; i < n + 3; i++) {
+            w[i] = c[1] * w[i - 1] + c[2] * w[i - 2] + c[3] * w[i - 3];
+        }
+        for (int i = n + 2; i >= 3; i--) {
+            double t = c[0] * w[i];
+            t += c[1] * y[i + 1];
+            t += c[2] * y[i + 2];
+            t += c[3] * y[i + 3];
+            y[i] = t;
+        }
+        for (int i = 0; i < 3; i++) {
+            f->edge[i][j] = y[3 + i];
+        }
+    }
 
-            for (int y = 0; y < radius; y++) {
-                val_r += src[(y * width + x) * channels];
-                val_g += src[(y * width + x) * channels + 1];
-                val_b += src[(y * width + x) * channels + 2];
-            }
+    free(w);
+    return 1;
+}
 
-            for (int y = 0; y <= radius; y++) {
-                val_r += src[((y + radius) * width + x) * channels] - src[col_offset];
-                val_g += src[((y + radius) * width + x) * channels + 1] - src[col_offset + 1];
-                val_b += src[((y + radius) * width + x) * channels + 2] - src[col_offset + 2];
+// Byte x of row, premultiplied when the row is RGBA that is.
+static inline double iir_value(const unsigned char *row, int x, int premultiplied) {
+    return (premultiplied && x % 4 != 3) ? premultiply(row[x], row[x | 3]) : row[x];
+}
 
-                dst[(y * width + x) * channels] = (unsigned char)(val_r * iarr);
-                dst[(y * width + x) * channels + 1] = (unsigned char)(val_g * iarr);
-                dst[(y * width + x) * channels + 2] = (unsigned char)(val_b * iarr);
-            }
+/**
+ * Vertical recursive pass over byte columns [x0, x1) from src into dst,
+ * which may be the same image. The forward pass keeps its history in buf
+ * (height rows of IIR_STRIP doubles plus three for the edge), the backward
+ * pass rewrites it and stores the bytes. Edges repeat the first and last
+ * row, as the box blur does. For RGBA the forward pass can premultiply
+ * what it reads and the backward pass unpremultiply what it writes, see
+ * iir_gaussian_blur.
+ */
+static void iir_v_blur_strip(const Image *src, Image *dst, const IirFilter *f, double *buf, int x0, int x1,
+                             int premultiply_src, int unpremultiply_dst) {
+    const int height = src->height;
+    const int n = x1 - x0;
+    double *tail = buf + (size_t)height * IIR_STRIP;
+    const unsigned char *first = image_row(src, 0) + x0;
+    const unsigned char *last = image_row(src, height - 1) + x0;
+
+    for (int x = 0; x < n; x++) {
+        tail[x] = iir_value(first, x, premultiply_src);
+    }
 
-            for (int y = radius + 1; y < height - radius; y++) {
-                val_r += src[((y + radius) * width + x) * channels] - src[((y - radius - 1) * width + x) * channels];
-                val_g += src[((y + radius) * width + x) * channels + 1] - src[((y - radius - 1) * width + x) * channels + 1];
-                val_b += src[((y + radius) * width + x) * channels + 2] - src[((y - radius - 1) * width + x) * channels + 2];
+    for (int y = 0; y < height; y++) {
+        const double *w1 = (y >= 1) ? buf + (size_t)(y - 1) * IIR_STRIP : tail;
+        const double *w2 = (y >= 2) ? buf + (size_t)(y - 2) * IIR_STRIP : tail;
+        const double *w3 = (y >= 3) ? buf + (size_t)(y - 3) * IIR_STRIP : tail;
+        kernels->iir_forward_row(image_row(src, y) + x0, buf + (size_t)y * IIR_STRIP, w1, w2, w3, n,
+                                 premultiply_src, f->coef);
+    }
 
-                dst[(y * width + x) * channels] = (unsigned char)(val_r * iarr);
-                dst[(y * width + x) * channels + 1] = (unsigned char)(val_g * iarr);
-                dst[(y * width + x) * channels + 2] = (unsigned char)(val_b * iarr);
-            }
+    for (int x = 0; x < n; x++) {
+        const double u = iir_value(last, x, premultiply_src);
+        double d[3];
+        for (int j = 0; j < 3; j++) {
+            d[j] = ((height - 1 - j >= 0) ? buf[(size_t)(height - 1 - j) * IIR_STRIP + x]
+                                          : iir_value(first, x, premultiply_src)) - u;
+        }
+        for (int i = 0; i < 3; i++) {
+            tail[i * IIR_STRIP + x] = u + f->edge[i][0] * d[0] + f->edge[i][1] * d[1] + f->edge[i][2] * d[2];
+        }
+    }
 
-            for (int y = height - radius; y < height; y++) {
-                val_r += src[((height - 1) * width + x) * channels] - src[((y - radius - 1) * width + x) * channels];
-                val_g += src[((height - 1) * width + x) * channels + 1] - src[((y - radius - 1) * width + x) * channels + 1];
-                val_b += src[((height - 1) * width + x) * channels + 2] - src[((y - radius - 1) * width + x) * channels + 2];
+    for (int y = height - 1; y >= 0; y--) {
+        const double *y1 = buf + (size_t)(y + 1) * IIR_STRIP;
+        const double *y2 = buf + (size_t)(y + 2) * IIR_STRIP;
+        const double *y3 = buf + (size_t)(y + 3) * IIR_STRIP;
+        kernels->iir_backward_row(buf + (size_t)y * IIR_STRIP, y1, y2, y3, image_row(dst, y) + x0, n,
+                                  unpremultiply_dst, f->coef);
+    }
+}
 
-                dst[(y * width + x) * channels] = (unsigned char)(val_r * iarr);
-                dst[(y * width + x) * channels + 1] = (unsigned char)(val_g * iarr);
-                dst[(y * width + x) * channels + 2] = (unsigned char)(val_b * iarr);
-            }
+// bufs holds one strip buffer of (height + 3) * IIR_STRIP doubles per thread.
+static void iir_v_blur(const Image *src, Image *dst, const IirFilter *f, double *bufs,
+                       int premultiply_src, int unpremultiply_dst) {
+    const int row_size = src->width * src->channels;
+    const int num_strips = (row_size + IIR_STRIP - 1) / IIR_STRIP;
+    const size_t buf_size = (size_t)(src->height + 3) * IIR_STRIP;
 
-            if (channels == 4) {
-                for (int y = 0; y < height; y++) {
-                    dst[(y * width + x) * channels + 3] = src[(y * width + x) * channels + 3];
-                }
-            }
+    if (USE_THREADS_FOR(src->width * src->height)) {
+        #pragma omp parallel for schedule(static)
+        for (int s = 0; s < num_strips; s++) {
+            const int x0 = s * IIR_STRIP;
+            const int x1 = (x0 + IIR_STRIP < row_size) ? x0 + IIR_STRIP : row_size;
+            iir_v_blur_strip(src, dst, f, bufs + omp_get_thread_num() * buf_size, x0, x1,
+                             premultiply_src, unpremultiply_dst);
+        }
+    } else {
+        for (int s = 0; s < num_strips; s++) {
+            const int x0 = s * IIR_STRIP;
+            const int x1 = (x0 + IIR_STRIP < row_size) ? x0 + IIR_STRIP : row_size;
+            iir_v_blur_strip(src, dst, f, bufs, x0, x1, premultiply_src, unpremultiply_dst);
         }
     }
 }
 
-static void box_blur(unsigned char *src, unsigned char *dst, unsigned char *temp,
-                     int width, int height, int channels, int radius) {
-    box_h_blur(src, temp, width, height, channels, radius);
-    box_v_blur(temp, dst, width, height, channels, radius);
-}
+/**
+ * Gaussian blur by recursive filtering, for any sigma at the same cost per
+ * pixel. Columns are filtered with SIMD lanes across the row; rows are
+ * filtered the same way on a transposed copy, so there the lanes run
+ * across rows. RGBA is filtered premultiplied, rows first: the row pass
+ * premultiplies as it reads, and the column pass reads a second copy and
+ * divides by the blurred alpha as it writes the image, which keeps its
+ * own alpha.
+ */
+void iir_gaussian_blur(Image *image, float sigma) {
+    if (sigma < 1.0f || sigma > 250.0f) {
+        fprintf(stderr, "Error: Sigma must be between 1 and 250\n");
+        return;
+    }
 
-void gaussian_blur(unsigned char *image, int width, int height, int channels, float sigma) {
-    if (sigma < 1 || sigma > 10.0f) {
-        fprintf(stderr, "Error: Sigma must be between 1 and 10\n");
+    IirFilter f;
+    const int have_filter = iir_filter(&f, sigma);
+
+    const int longest = (image->width > image->height) ? image->width : image->height;
+    const int threads = USE_THREADS_FOR(image->width * image->height) ? omp_get_max_threads() : 1;
+    const ScratchMark mark = scratch_mark();
+    double *bufs = (double *)scratch_alloc((size_t)threads * (longest + 3) * IIR_STRIP * sizeof(double));
+    const int premultiplied = image->channels == 4;
+
+    Image transposed;
+    Image rows;
+    const int have_transposed = scratch_image(&transposed, image->height, image->width, image->channels, 0);
+    const int have_rows = !premultiplied || scratch_image(&rows, image->width, image->height, image->channels, 0);
+
+    if (!have_filter || !have_transposed || !have_rows || !bufs) {
+        fprintf(stderr, "Error: Failed to allocate temporary buffer\n");
+        scratch_release(mark);
         return;
     }
 
+    if (premultiplied) {
+        image_transpose(&transposed, image);
+        iir_v_blur(&transposed, &transposed, &f, bufs, 1, 0);
+        image_transpose(&rows, &transposed);
+        iir_v_blur(&rows, image, &f, bufs, 0, 1);
+    } else {
+        iir_v_blur(image, image, &f, bufs, 0, 0);
+        image_transpose(&transposed, image);
+        iir_v_blur(&transposed, &transposed, &f, bufs, 0, 0);
+        image_transpose(image, &transposed);
+    }
+
+    scratch_release(mark);
+}
+
+int gaussian_blur_radius(float sigma) {
     int boxes[3];
     box_radii(boxes, sigma);
+    return boxes[0] + boxes[1] + boxes[2];
+}
 
-    unsigned char *temp = (unsigned char *)malloc(width * height * channels);
-    unsigned char *buffer = (unsigned char *)malloc(width * height * channels);
+int edge_detect_radius(float threshold) {
+    (void)threshold;
+    return 1;
+}
 
-    if (!temp || !buffer) {
-        fprintf(stderr, "Error: Failed tp allocate temporary buffer\n");
-        if (temp) free(temp);
-        if (buffer) free(buffer);
-        return;
+// Gray row y of an interleaved or planar image, see kernels->gray_row.
+static void edge_gray_row(const Image *image, int y, unsigned char *gray) {
+    if (image->flags & IMAGE_PLANAR) {
+        unsigned char *planes[4] = {NULL, NULL, NULL, NULL};
+        for (int c = 0; c < image->channels && c < 4; c++) {
+            planes[c] = image_plane_row(image, c, y);
+        }
+        kernels->gray_planar_row(planes, gray, image->width, image->channels);
+    } else {
+        kernels->gray_row(image_row(image, y), gray, image->width, image->channels);
     }
+}
 
-    memcpy(buffer, image, width * height * channels);
-    for (int i = 0; i < 3; i++) {
-        box_blur(buffer, image, temp, width, height, channels, boxes[i]);
-        if (i < 2) memcpy(buffer, image, width * height * channels);
+// Edge mask row y into the image; a planar image gets it in each colour plane.
+static void edge_store_row(Image *image, int y, const unsigned char *above, const unsigned char *row,
+                           const unsigned char *below, int limit) {
+    if (image->flags & IMAGE_PLANAR) {
+        unsigned char *out = image_plane_row(image, 0, y);
+        kernels->edge_row(above, row, below, out, image->width, 1, limit);
+
+        const int colour = (image->channels == 4) ? 3 : image->channels;
+        for (int c = 1; c < colour; c++) {
+            memcpy(image_plane_row(image, c, y), out, image->width);
+        }
+    } else {
+        kernels->edge_row(above, row, below, image_row(image, y), image->width, image->channels, limit);
     }
+}
+
+// The gray rows just above and below band b, into edges[0] and edges[width].
+static void edge_band_edges(const Image *image, int b, unsigned char *edges) {
+    const int y0 = b * EDGE_BAND;
+    const int y1 = (y0 + EDGE_BAND < image->height) ? y0 + EDGE_BAND : image->height;
+
+    if (y0 > 0) edge_gray_row(image, y0 - 1, edges);
+    if (y1 < image->height) edge_gray_row(image, y1, edges + image->width);
+}
+
+/**
+ * Band b of the edge mask, written in place. Gray rows are made one row
+ * ahead of the output in a ring of three, so the image is read and
+ * written in a single sweep; the rows on either side of the band come
+ * from edges, converted before any band was written.
+ */
+static void edge_band(Image *image, int b, const unsigned char *edges, unsigned char *ring, int limit) {
+    const int width = image->width;
+    const int y0 = b * EDGE_BAND;
+    const int y1 = (y0 + EDGE_BAND < image->height) ? y0 + EDGE_BAND : image->height;
+
+    const unsigned char *above = (y0 > 0) ? edges : NULL;
+    const unsigned char *row = ring;
+    edge_gray_row(image, y0, ring);
+
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *below = (y1 < image->height) ? edges + width : NULL;
+        if (y + 1 < y1) {
+            unsigned char *next = ring;
+            while (next == above || next == row) next += width;
+            edge_gray_row(image, y + 1, next);
+            below = next;
+        }
 
-    free(temp);
-    free(buffer);
+        edge_store_row(image, y, above, row, below, limit);
+        above = row;
+        row = below;
+    }
 }
 
-void edge_detect(unsigned char *image, int width, int height, int channels, float threshold) {
+/**
+ * Sobel edge mask: 255 where the gradient of the gray image is above
+ * threshold, 0 elsewhere and on the border, written to every channel but
+ * alpha. Works on interleaved and IMAGE_PLANAR images. Rows are done in
+ * bands of EDGE_BAND, so besides two gray rows per band each thread only
+ * keeps three gray rows.
+ */
+void edge_detect(Image *image, float threshold) {
     if (threshold < 0.0f || threshold > 255.0f) {
         fprintf(stderr, "Error: Threshold must be between 0 and 255.\n");
         return;
     }
 
-    unsigned char *temp = (unsigned char*)malloc(width * height * channels);
-    unsigned char *gray = (unsigned char*)malloc(width * height);
+    const int width = image->width;
+    const int height = image->height;
+    const int num_bands = (height + EDGE_BAND - 1) / EDGE_BAND;
+    const int threads = USE_THREADS_FOR(width * height) ? omp_get_max_threads() : 1;
 
-    if (!temp || !gray) {
+    const ScratchMark mark = scratch_mark();
+    unsigned char *edges = (unsigned char *)scratch_alloc((size_t)num_bands * 2 * width);
+    unsigned char *rings = (unsigned char *)scratch_alloc((size_t)threads * 3 * width);
+
+    if (!edges || !rings) {
         fprintf(stderr, "Error: Failed to allocate temporary buffers for edge detection.\n");
-        if (temp) free(temp);
-        if (gray) free(gray);
+        scratch_release(mark);
         return;
     }
 
-    memcpy(temp, image, width * height * channels);
-
-    const float threshold_squared = threshold * threshold;
+    // gx^2 + gy^2 is an integer, so comparing it to the truncated square is the same test
+    const int limit = (int)(threshold * threshold);
 
-    const float r_weight = 0.299f;
-    const float g_weight = 0.587f;
-    const float b_weight = 0.114f;
+    if (USE_THREADS_FOR(width * height)) {
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < num_bands; b++) {
+            edge_band_edges(image, b, edges + (size_t)b * 2 * width);
+        }
 
-    if (use_thread) {
-        #pragma omp parallel for schedule(guided)
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int i = y * width + x;
-                int idx = i * channels;
-                gray[i] = (unsigned char)(r_weight * temp[idx] + g_weight * temp[idx + 1] + b_weight * temp[idx + 2]);
-            }
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < num_bands; b++) {
+            edge_band(image, b, edges + (size_t)b * 2 * width, rings + (size_t)omp_get_thread_num() * 3 * width, limit);
         }
     } else {
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int i = y * width + x;
-                int idx = i * channels;
-                gray[i] = (unsigned char)(r_weight * temp[idx] + g_weight * temp[idx + 1] + b_weight * temp[idx + 2]);
-            }
+        for (int b = 0; b < num_bands; b++) {
+            edge_band_edges(image, b, edges + (size_t)b * 2 * width);
         }
-    }
-
-    const int Gx[3][3] = {
-        {-1, 0, 1},
-        {-2, 0, 2},
-        {-1, 0, 1}
-    };
-
-    const int Gy[3][3] = {
-        { 1,  2,  1},
-        { 0,  0,  0},
-        {-1, -2, -1}
-    };
-
-    if (use_thread) {
-        #pragma omp parallel for schedule(guided)
-        for (int by = 1; by < height - 1; by += CACHE_BLOCK_SIZE) {
-            for (int bx = 1; bx < width - 1; bx += CACHE_BLOCK_SIZE) {
-                int block_h = (by + CACHE_BLOCK_SIZE > height - 1) ? (height - 1 - by) : CACHE_BLOCK_SIZE;
-                int block_w = (bx + CACHE_BLOCK_SIZE > width - 1) ? (width - 1 - bx) : CACHE_BLOCK_SIZE;
 
-                for (int y = 0; y < block_h; y++) {
-                    for (int x = 0; x < block_w; x++) {
-                        int img_y = by + y;
-                        int img_x = bx + x;
+        for (int b = 0; b < num_bands; b++) {
+            edge_band(image, b, edges + (size_t)b * 2 * width, rings, limit);
+        }
+    }
 
-                        if (img_y == 0 || img_y == height - 1 || img_x == 0 || img_x == width - 1) {
-                            continue;
-                        }
+    scratch_release(mark);
+}
 
-                        int gx = 0, gy = 0;
+// edge_detect handles IMAGE_PLANAR images itself.
+void edge_detect_planar(Image *image, float threshold) {
+    edge_detect(image, threshold);
+}
 
-                        int p00 = gray[(img_y-1) * width + (img_x-1)];
-                        int p01 = gray[(img_y-1) * width + img_x];
-                        int p02 = gray[(img_y-1) * width + (img_x+1)];
+// Gradient row y of the blurred gray plane; the first and last row have none.
+static void canny_gradient(const Image *gray, int y, int *mag, unsigned char *dir) {
+    if (y <= 0 || y >= gray->height - 1) {
+        memset(mag, 0, (size_t)gray->width * sizeof(int));
+        memset(dir, 0, gray->width);
+        return;
+    }
+    kernels->canny_gradient_row(image_row(gray, y - 1), image_row(gray, y), image_row(gray, y + 1),
+                                mag, dir, gray->width);
+}
 
-                        gx += p00 * Gx[0][0];
-                        gx += p01 * Gx[0][1];
-                        gx += p02 * Gx[0][2];
+/**
+ * Band b of the strong/weak map. Gradient rows are made one row ahead of
+ * the suppression in a ring of three, so the band needs no gradient plane;
+ * the gray plane is read-only by now, so bands never wait on each other.
+ */
+static void canny_nms_band(const Image *gray, int b, unsigned char *map, int *mags, unsigned char *dirs,
+                           int low, int high) {
+    const int width = gray->width;
+    const int y0 = b * EDGE_BAND;
+    const int y1 = (y0 + EDGE_BAND < gray->height) ? y0 + EDGE_BAND : gray->height;
+
+    canny_gradient(gray, y0 - 1, mags, dirs);
+    canny_gradient(gray, y0, mags + width, dirs + width);
+
+    for (int y = y0; y < y1; y++) {
+        const int above = (y - y0) % 3, row = (y - y0 + 1) % 3, below = (y - y0 + 2) % 3;
+        canny_gradient(gray, y + 1, mags + below * width, dirs + below * width);
+        kernels->canny_nms_row(mags + above * width, mags + row * width, mags + below * width, dirs + row * width,
+                               map + (size_t)y * width, width, low, high);
+    }
+}
 
-                        gy += p00 * Gy[0][0];
-                        gy += p01 * Gy[0][1];
-                        gy += p02 * Gy[0][2];
+typedef struct {
+    size_t *data;
+    size_t size;
+    size_t capacity;
+} CannyStack;
+
+static int canny_push(CannyStack *stack, size_t p) {
+    if (stack->size == stack->capacity) {
+        const size_t capacity = stack->capacity ? 2 * stack->capacity : 4096;
+        size_t *data = (size_t *)realloc(stack->data, capacity * sizeof(size_t));
+        if (!data) {
+            return 0;
+        }
+        stack->data = data;
+        stack->capacity = capacity;
+    }
+    stack->data[stack->size++] = p;
+    return 1;
+}
 
-                        int p10 = gray[img_y * width + (img_x-1)];
-                        int p11 = gray[img_y * width + img_x];
-                        int p12 = gray[img_y * width + (img_x+1)];
+/**
+ * Hysteresis from the strong pixels of band b: every weak pixel reached
+ * through 8-connected weak pixels is set in claimed. map is read-only by
+ * now; a thread claims a pixel by swapping in 1 atomically and only the
+ * one that saw 0 follows it, so floods from different bands may cross
+ * without a second pass and the result does not depend on the order they
+ * run in. Border pixels of map are always 0, so a followed pixel never
+ * has a neighbour outside the image. Returns 0 if the stack cannot grow.
+ */
+static int canny_follow_band(const unsigned char *map, unsigned char *claimed, int width, int height, int b,
+                             CannyStack *stack) {
+    const int y0 = b * EDGE_BAND;
+    const int y1 = (y0 + EDGE_BAND < height) ? y0 + EDGE_BAND : height;
+    const unsigned char *end = map + (size_t)y1 * width;
+
+    for (const unsigned char *seed = map + (size_t)y0 * width;
+         (seed = (const unsigned char *)memchr(seed, 2, end - seed)) != NULL; seed++) {
+        stack->size = 0;
+        if (!canny_push(stack, seed - map)) return 0;
+
+        while (stack->size > 0) {
+            const size_t p = stack->data[--stack->size];
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    const size_t q = p + (ptrdiff_t)dy * width + dx;
+                    if (map[q] != 1) continue;
+
+                    unsigned char old;
+                    #pragma omp atomic capture
+                    { old = claimed[q]; claimed[q] = 1; }
+                    if (!old && !canny_push(stack, q)) return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
 
-                        gx += p10 * Gx[1][0];
-                        gx += p11 * Gx[1][1];
-                        gx += p12 * Gx[1][2];
+// Row y of the final mask into the image, kept in map; a planar image gets it in each colour plane.
+static void canny_store_row(Image *image, int y, unsigned char *map, const unsigned char *claimed) {
+    for (int x = 0; x < image->width; x++) {
+        map[x] = (map[x] == 2 || claimed[x]) ? 255 : 0;
+    }
 
-                        gy += p10 * Gy[1][0];
-                        gy += p11 * Gy[1][1];
-                        gy += p12 * Gy[1][2];
+    if (image->flags & IMAGE_PLANAR) {
+        const int colour = (image->channels == 4) ? 3 : image->channels;
+        for (int c = 0; c < colour; c++) {
+            memcpy(image_plane_row(image, c, y), map, image->width);
+        }
+    } else {
+        kernels->mask_row(map, image_row(image, y), image->width, image->channels);
+    }
+}
 
-                        int p20 = gray[(img_y+1) * width + (img_x-1)];
-                        int p21 = gray[(img_y+1) * width + img_x];
-                        int p22 = gray[(img_y+1) * width + (img_x+1)];
+/**
+ * Canny edge mask: the gray image is blurred with gaussian_blur at
+ * CANNY_SIGMA, thinned to gradient maxima and kept where the gradient is
+ * above threshold or connected to such a pixel through ones above
+ * threshold * CANNY_LOW_RATIO. 255 on edges and 0 elsewhere, in every
+ * channel but alpha. Suppression runs in bands of EDGE_BAND rows and the
+ * hysteresis floods from each band's strong pixels in parallel.
+ */
+void canny_edge_detect(Image *image, float threshold) {
+    if (threshold < 0.0f || threshold > 255.0f) {
+        fprintf(stderr, "Error: Threshold must be between 0 and 255.\n");
+        return;
+    }
 
-                        gx += p20 * Gx[2][0];
-                        gx += p21 * Gx[2][1];
-                        gx += p22 * Gx[2][2];
+    const int width = image->width;
+    const int height = image->height;
+    const int num_bands = (height + EDGE_BAND - 1) / EDGE_BAND;
+    const int threads = USE_THREADS_FOR(width * height) ? omp_get_max_threads() : 1;
+
+    const ScratchMark mark = scratch_mark();
+    Image gray;
+    const int have_gray = scratch_image(&gray, width, height, 1, 0);
+    unsigned char *map = (unsigned char *)scratch_alloc((size_t)width * height);
+    unsigned char *claimed = (unsigned char *)scratch_alloc((size_t)width * height);
+    int *mags = (int *)scratch_alloc((size_t)threads * 3 * width * sizeof(int));
+    unsigned char *dirs = (unsigned char *)scratch_alloc((size_t)threads * 3 * width);
+    CannyStack *stacks = (CannyStack *)scratch_alloc(threads * sizeof(CannyStack));
+
+    if (!have_gray || !map || !claimed || !mags || !dirs || !stacks) {
+        fprintf(stderr, "Error: Failed to allocate temporary buffer\n");
+        scratch_release(mark);
+        return;
+    }
+    memset(stacks, 0, threads * sizeof(CannyStack));
 
-                        gy += p20 * Gy[2][0];
-                        gy += p21 * Gy[2][1];
-                        gy += p22 * Gy[2][2];
+    const float low_threshold = threshold * CANNY_LOW_RATIO;
+    const int high = (int)(threshold * threshold);
+    const int low = (int)(low_threshold * low_threshold);
+    int followed = 1;
 
-                        int magnitude_squared = gx * gx + gy * gy;
+    if (USE_THREADS_FOR(width * height)) {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; y++) {
+            edge_gray_row(image, y, image_row(&gray, y));
+            memset(claimed + (size_t)y * width, 0, width);
+        }
+    } else {
+        for (int y = 0; y < height; y++) {
+            edge_gray_row(image, y, image_row(&gray, y));
+            memset(claimed + (size_t)y * width, 0, width);
+        }
+    }
 
-                        unsigned char edge_value = (magnitude_squared > threshold_squared) ? 255 : 0;
+    gaussian_blur(&gray, CANNY_SIGMA);
 
-                        int idx = (img_y * width + img_x) * channels;
+    if (USE_THREADS_FOR(width * height)) {
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < num_bands; b++) {
+            const int t = omp_get_thread_num();
+            canny_nms_band(&gray, b, map, mags + (size_t)t * 3 * width, dirs + (size_t)t * 3 * width, low, high);
+        }
 
-                        for (int c = 0; c < channels; c++) {
-                            if (channels == 4 && c == 3) {
-                                image[idx + c] = temp[idx + c];
-                            } else {
-                                image[idx + c] = edge_value;
-                            }
-                        }
-                    }
-                }
+        // strong pixels cluster, so bands are handed out as threads finish
+        #pragma omp parallel for schedule(dynamic)
+        for (int b = 0; b < num_bands; b++) {
+            if (!canny_follow_band(map, claimed, width, height, b, &stacks[omp_get_thread_num()])) {
+                #pragma omp atomic write
+                followed = 0;
             }
         }
 
-        #pragma omp parallel for schedule(guided)
+        #pragma omp parallel for schedule(static)
         for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
-                    for (int c = 0; c < channels; c++) {
-                        if (channels == 4 && c == 3) {
-                            continue;
-                        }
-                        int idx = (y * width + x) * channels + c;
-                        image[idx] = 0;
-                    }
-                }
-            }
+            canny_store_row(image, y, map + (size_t)y * width, claimed + (size_t)y * width);
         }
     } else {
-        for (int by = 1; by < height - 1; by += CACHE_BLOCK_SIZE) {
-            for (int bx = 1; bx < width - 1; bx += CACHE_BLOCK_SIZE) {
-                int block_h = (by + CACHE_BLOCK_SIZE > height - 1) ? (height - 1 - by) : CACHE_BLOCK_SIZE;
-                int block_w = (bx + CACHE_BLOCK_SIZE > width - 1) ? (width - 1 - bx) : CACHE_BLOCK_SIZE;
-
-                for (int y = 0; y < block_h; y++) {
-                    for (int x = 0; x < block_w; x++) {
-                        int img_y = by + y;
-                        int img_x = bx + x;
-
-                        if (img_y == 0 || img_y == height - 1 || img_x == 0 || img_x == width - 1) {
-                            continue;
-                        }
+        for (int b = 0; b < num_bands; b++) {
+            canny_nms_band(&gray, b, map, mags, dirs, low, high);
+        }
 
-                        int gx = 0, gy = 0;
+        for (int b = 0; b < num_bands && followed; b++) {
+            followed = canny_follow_band(map, claimed, width, height, b, &stacks[0]);
+        }
 
-                        int p00 = gray[(img_y-1) * width + (img_x-1)];
-                        int p01 = gray[(img_y-1) * width + img_x];
-                        int p02 = gray[(img_y-1) * width + (img_x+1)];
+        for (int y = 0; y < height; y++) {
+            canny_store_row(image, y, map + (size_t)y * width, claimed + (size_t)y * width);
+        }
+    }
 
-                        gx += p00 * Gx[0][0];
-                        gx += p01 * Gx[0][1];
-                        gx += p02 * Gx[0][2];
+    if (!followed) {
+        fprintf(stderr, "Error: Failed to allocate temporary buffer\n");
+    }
 
-                        gy += p00 * Gy[0][0];
-                        gy += p01 * Gy[0][1];
-                        gy += p02 * Gy[0][2];
+    for (int t = 0; t < threads; t++) {
+        free(stacks[t].data);
+    }
+    scratch_release(mark);
+}
 
-                        int p10 = gray[img_y * width + (img_x-1)];
-                        int p11 = gray[img_y * width + img_x];
-                        int p12 = gray[img_y * width + (img_x+1)];
+void grayscale_matrix(float m[3][4], float param) {
+    (void)param;
+    for (int i = 0; i < 3; i++) {
+        m[i][0] = GRAY_R_WEIGHT;
+        m[i][1] = GRAY_G_WEIGHT;
+        m[i][2] = GRAY_B_WEIGHT;
+        m[i][3] = 0.0f;
+    }
+}
 
-                        gx += p10 * Gx[1][0];
-                        gx += p11 * Gx[1][1];
-                        gx += p12 * Gx[1][2];
+void sepia_matrix(float m[3][4], float param) {
+    (void)param;
+    static const float c_sepia[3][3] = {
+        {0.393f, 0.769f, 0.189f},
+        {0.349f, 0.686f, 0.168f},
+        {0.272f, 0.534f, 0.131f}
+    };
 
-                        gy += p10 * Gy[1][0];
-                        gy += p11 * Gy[1][1];
-                        gy += p12 * Gy[1][2];
+    for (int i = 0; i < 3; i++) {
+        m[i][0] = c_sepia[i][0];
+        m[i][1] = c_sepia[i][1];
+        m[i][2] = c_sepia[i][2];
+        m[i][3] = 0.0f;
+    }
+}
 
-                        int p20 = gray[(img_y+1) * width + (img_x-1)];
-                        int p21 = gray[(img_y+1) * width + img_x];
-                        int p22 = gray[(img_y+1) * width + (img_x+1)];
+void saturation_matrix(float m[3][4], float factor) {
+    const float weights[3] = {GRAY_R_WEIGHT, GRAY_G_WEIGHT, GRAY_B_WEIGHT};
 
-                        gx += p20 * Gx[2][0];
-                        gx += p21 * Gx[2][1];
-                        gx += p22 * Gx[2][2];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            m[i][j] = (1.0f - factor) * weights[j] + ((i == j) ? factor : 0.0f);
+        }
+        m[i][3] = 0.0f;
+    }
+}
 
-                        gy += p20 * Gy[2][0];
-                        gy += p21 * Gy[2][1];
-                        gy += p22 * Gy[2][2];
+void swap_rb_matrix(float m[3][4], float param) {
+    (void)param;
+    memset(m, 0, 3 * 4 * sizeof(float));
+    m[0][2] = 1.0f;
+    m[1][1] = 1.0f;
+    m[2][0] = 1.0f;
+}
 
-                        int magnitude_squared = gx * gx + gy * gy;
+void tint_matrix(float m[3][4], float warmth) {
+    memset(m, 0, 3 * 4 * sizeof(float));
+    m[0][0] = 1.0f + 0.15f * warmth;
+    m[1][1] = 1.0f;
+    m[2][2] = 1.0f - 0.15f * warmth;
+}
 
-                        unsigned char edge_value = (magnitude_squared > threshold_squared) ? 255 : 0;
+void color_matrix_row(unsigned char *row, int width, int channels, const float m[3][4]) {
+    kernels->color_matrix_row(row, width, channels, m);
+}
 
-                        int idx = (img_y * width + img_x) * channels;
+void color_matrix_planar_row(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width, const float m[3][4]) {
+    kernels->color_matrix_planar_row(r_row, g_row, b_row, width, m);
+}
 
-                        for (int c = 0; c < channels; c++) {
-                            if (channels == 4 && c == 3) {
-                                image[idx + c] = temp[idx + c];
-                            } else {
-                                image[idx + c] = edge_value;
-                            }
-                        }
-                    }
-                }
-            }
-        }
+int fixed_from_float(float value) {
+    return (int)floorf(value * FIXED_ONE + 0.5f);
+}
 
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
-                    for (int c = 0; c < channels; c++) {
-                        if (channels == 4 && c == 3) {
-                            continue;
-                        }
-                        int idx = (y * width + x) * channels + c;
-                        image[idx] = 0;
-                    }
-                }
-            }
+// Coefficients are clamped to 16 bits for pmaddwd; in-gamut matrices stay far below that.
+void color_matrix_fixed(int q[3][4], const float m[3][4]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            const int c = fixed_from_float(m[i][j]);
+            q[i][j] = (c > 32767) ? 32767 : ((c < -32768) ? -32768 : c);
         }
+        q[i][3] = fixed_from_float(m[i][3]);
     }
+}
 
-    free(temp);
-    free(gray);
+void color_matrix_fixed_row(unsigned char *row, int width, int channels, const int m[3][4]) {
+    kernels->color_matrix_fixed_row(row, width, channels, m);
 }
 
+void color_matrix_fixed_planar_row(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width, const int m[3][4]) {
+    kernels->color_matrix_fixed_planar_row(r_row, g_row, b_row, width, m);
+}
 
-void grayscale(unsigned char *image, int width, int height, int channels, float param) {
+void color_matrix(Image *image, const float m[3][4]) {
+    if (image->channels != 3 && image->channels != 4) {
+        fprintf(stderr, "Error: Color matrix filters require 3 or 4 channels.\n");
+        return;
+    }
 
-    const float r_factor = 0.298f;
-    const float g_factor = 0.587f;
-    const float b_factor = 0.114f;
+    const int total_pixels = image->width * image->height;
 
-    const int total_pixels = width * height;
+    if (use_fixed_point) {
+        int q[3][4];
+        color_matrix_fixed(q, m);
 
-    if (use_thread){
-#pragma omp parallel for schedule(guided)
-        for (int block_y = 0; block_y < height; block_y += CACHE_BLOCK_SIZE) {
-            for (int block_x = 0; block_x < width; block_x += CACHE_BLOCK_SIZE) {
-                const int max_y = (block_y + CACHE_BLOCK_SIZE < height) ? block_y + CACHE_BLOCK_SIZE : height;
-                const int max_x = (block_x + CACHE_BLOCK_SIZE < width) ? block_x + CACHE_BLOCK_SIZE : width;
-
-                for (int y = block_y; y < max_y; y++) {
-                    #pragma omp simd
-                    for (int x = block_x; x < max_x; x++) {
-                        const int idx = (y * width + x) * channels;
-                        const float gray = r_factor * image[idx] + g_factor * image[idx + 1] + b_factor * image[idx + 2];
-                        const unsigned char gray_byte = (unsigned char)gray;
-
-                        image[idx] = gray_byte;
-                        image[idx + 1] = gray_byte;
-                        image[idx + 2] = gray_byte;
-                    }
-                }
+        if (USE_THREADS_FOR(total_pixels)) {
+            #pragma omp parallel for schedule(static)
+            for (int y = 0; y < image->height; y++) {
+                color_matrix_fixed_row(image_row(image, y), image->width, image->channels, (const int (*)[4])q);
+            }
+        } else {
+            for (int y = 0; y < image->height; y++) {
+                color_matrix_fixed_row(image_row(image, y), image->width, image->channels, (const int (*)[4])q);
             }
         }
+        return;
+    }
+
+    if (USE_THREADS_FOR(total_pixels)) {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < image->height; y++) {
+            color_matrix_row(image_row(image, y), image->width, image->channels, m);
+        }
     } else {
-        for (int block_y = 0; block_y < height; block_y += CACHE_BLOCK_SIZE) {
-            for (int block_x = 0; block_x < width; block_x += CACHE_BLOCK_SIZE) {
-                const int max_y = (block_y + CACHE_BLOCK_SIZE < height) ? block_y + CACHE_BLOCK_SIZE : height;
-                const int max_x = (block_x + CACHE_BLOCK_SIZE < width) ? block_x + CACHE_BLOCK_SIZE : width;
+        for (int y = 0; y < image->height; y++) {
+            color_matrix_row(image_row(image, y), image->width, image->channels, m);
+        }
+    }
+}
 
-                for (int y = block_y; y < max_y; y++) {
-                    #pragma omp simd
-                    for (int x = block_x; x < max_x; x++) {
-                        const int idx = (y * width + x) * channels;
+void grayscale(Image *image, float param) {
+    float m[3][4];
+    grayscale_matrix(m, param);
+    color_matrix(image, (const float (*)[4])m);
+}
 
-                        const float gray = r_factor * image[idx] + g_factor * image[idx + 1] + b_factor * image[idx + 2];
+void sepia(Image *image, float param) {
+    float m[3][4];
+    sepia_matrix(m, param);
+    color_matrix(image, (const float (*)[4])m);
+}
 
-                        const unsigned char gray_byte = (unsigned char)gray;
+void saturation(Image *image, float factor) {
+    float m[3][4];
+    saturation_matrix(m, factor);
+    color_matrix(image, (const float (*)[4])m);
+}
 
-                        image[idx] = gray_byte;
-                        image[idx + 1] = gray_byte;
-                        image[idx + 2] = gray_byte;
-                    }
-                }
-            }
-        }
-    }
+void swap_rb(Image *image, float param) {
+    float m[3][4];
+    swap_rb_matrix(m, param);
+    color_matrix(image, (const float (*)[4])m);
 }
 
-void invert(unsigned char *image, int width, int height, int channels, float param) {
-    const int total_size = width * height * channels;
+void tint(Image *image, float warmth) {
+    float m[3][4];
+    tint_matrix(m, warmth);
+    color_matrix(image, (const float (*)[4])m);
+}
 
-    if (use_thread){
+void invert(Image *image, float param) {
+    (void)param;
+    if (USE_THREADS_FOR(image->width * image->height)) {
 #pragma omp parallel for schedule(guided)
-        for (int i = 0; i < total_size; i += channels) {
-            for (int c = 0; c < 3 && c < channels; c++) {
-                image[i + c] = 255 - image[i + c];
-            }
+        for (int y = 0; y < image->height; y++) {
+            kernels->invert_row(image_row(image, y), image->width, image->channels);
         }
     } else {
-        for (int i = 0; i < total_size; i += channels) {
-            for (int c = 0; c < 3 && c < channels; c++) {
-                image[i + c] = 255 - image[i + c];
-            }
+        for (int y = 0; y < image->height; y++) {
+            kernels->invert_row(image_row(image, y), image->width, image->channels);
         }
     }
 }
 
-void brightness(unsigned char *image, int width, int height, int channels, float brightness) {
+void brightness(Image *image, float brightness) {
     if (brightness < 0.1 || brightness > 2.0) {
         fprintf(stderr, "Error: Brightness must be between 0 and 2.\n");
         return;
     }
 
-    const int total_size = width * height * channels;
+    const int row_size = image->width * image->channels;
+    const int factor = fixed_from_float(brightness);
 
-    if (use_thread) {
+    if (USE_THREADS_FOR(image->width * image->height)) {
 #pragma omp parallel for schedule(guided)
-        for (int i = 0; i < total_size; i++) {
-            float new_val = image[i] * brightness;
-            image[i] = (new_val > 255.0f) ? 255 : (unsigned char)new_val;
+        for (int y = 0; y < image->height; y++) {
+            if (use_fixed_point) kernels->brightness_fixed_row(image_row(image, y), row_size, factor);
+            else kernels->brightness_row(image_row(image, y), row_size, brightness);
         }
     } else {
-        for (int i = 0; i < total_size; i++) {
-            float new_val = image[i] * brightness;
-            image[i] = (new_val > 255.0f) ? 255 : (unsigned char)new_val;
+        for (int y = 0; y < image->height; y++) {
+            if (use_fixed_point) kernels->brightness_fixed_row(image_row(image, y), row_size, factor);
+            else kernels->brightness_row(image_row(image, y), row_size, brightness);
         }
     }
 };
 
-void contrast(unsigned char *image, int width, int height, int channels, float factor) {
+void contrast(Image *image, float factor) {
     if (factor < 0.1 || factor > 2.0) {
         fprintf(stderr, "Error: Contrast must be between 0 and 2.\n");
         return;
     }
 
-    if (use_thread) {
+    const int row_size = image->width * image->channels;
+    const int scale = fixed_from_float(factor);
+
+    if (USE_THREADS_FOR(image->width * image->height)) {
 #pragma omp parallel for schedule(guided)
-        for (int i = 0; i < width * height * channels; i++) {
-            int tmp_image = (int)image[i];
-            tmp_image = CLAMP(factor * (tmp_image - 128) + 128);
-            image[i] = (unsigned char)tmp_image;
+        for (int y = 0; y < image->height; y++) {
+            if (use_fixed_point) kernels->contrast_fixed_row(image_row(image, y), row_size, scale);
+            else kernels->contrast_row(image_row(image, y), row_size, factor);
         }
     } else {
-        for (int i = 0; i < width * height * channels; i++) {
-            int tmp_image = (int)image[i];
-            tmp_image = CLAMP(factor * (tmp_image - 128) + 128);
-            image[i] = (unsigned char)tmp_image;
+        for (int y = 0; y < image->height; y++) {
+            if (use_fixed_point) kernels->contrast_fixed_row(image_row(image, y), row_size, scale);
+            else kernels->contrast_row(image_row(image, y), row_size, factor);
         }
     }
 }
-
-void sepia(unsigned char *image, int width, int height, int channels, float param) {
-    if (channels != 3 && channels != 4) {
-        fprintf(stderr, "Error: Sepia filter requires 3 or 4 channels.\n");
-        return;
-    }
-
-    static const float c_red[3] = {0.393f, 0.769f, 0.189f};
-    static const float c_green[3] = {0.349f, 0.686f, 0.168f};
-    static const float c_blue[3] = {0.272f, 0.534f, 0.131f};
-
-    const int total_pixels = width * height;
-
-    const int min_pixels_per_thread = 10000;
-
-    if (use_thread && total_pixels > min_pixels_per_thread) {
-        #pragma omp parallel for schedule(static, 8192)
-        for (int i = 0; i < total_pixels; i++) {
-            const int idx = i * channels;
-            const int r = image[idx];
-            const int g = image[idx + 1];
-            const int b = image[idx + 2];
-
-            const int sepia_red   = CLAMP((r * c_red[0] + g * c_red[1] + b * c_red[2]) );
-            const int sepia_green = CLAMP((r * c_green[0] + g * c_green[1] + b * c_green[2]));
-            const int sepia_blue  = CLAMP((r * c_blue[0] + g * c_blue[1] + b * c_blue[2]));
-
-            image[idx] = sepia_red;
-            image[idx + 1] = sepia_green;
-            image[idx + 2] = sepia_blue;
-        }
-    } else {
-        for (int i = 0; i < total_pixels; i++) {
-            const int idx = i * channels;
-            const int r = image[idx];
-            const int g = image[idx + 1];
-            const int b = image[idx + 2];
-
-            const int sepia_red   = CLAMP((r * c_red[0] + g * c_red[1] + b * c_red[2]) );
-            const int sepia_green = CLAMP((r * c_green[0] + g * c_green[1] + b * c_green[2]) );
-            const int sepia_blue  = CLAMP((r * c_blue[0] + g * c_blue[1] + b * c_blue[2]) );
-
-            image[idx] = sepia_red;
-            image[idx + 1] = sepia_green;
-            image[idx + 2] = sepia_blue;
-        }
-    }
-}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "image_utils.h"
+#include <string.h>
+
+Filter filter[] = {
+    {"--grayscale", grayscale, 0,
+        "Convert image to grayscale", 0.0f, 0.0f, POINT_MATRIX, grayscale_matrix, NULL, NULL},
+    {"--invert", invert, 0,
+        "Invert image colors", 0.0f, 0.0f, POINT_INVERT, NULL, NULL, NULL},
+    {"--brightness", brightness, 1,
+        "Adjust brightness", 0.1f, 2.0f, POINT_BRIGHTNESS, NULL, NULL, NULL},
+    {"--contrast", contrast, 1,
+        "Adjust contrast", 0.1f, 2.0f, POINT_CONTRAST, NULL, NULL, NULL},
+    {"--sepia", sepia, 0,
+        "Apply sepia effect", 0.0f, 0.0f, POINT_MATRIX, sepia_matrix, NULL, NULL},
+    {"--saturation", saturation, 1,
+        "Adjust color saturation", 0.0f, 2.0f, POINT_MATRIX, saturation_matrix, NULL, NULL},
+    {"--swap-rb", swap_rb, 0,
+        "Swap red and blue channels", 0.0f, 0.0f, POINT_MATRIX, swap_rb_matrix, NULL, NULL},
+    {"--tint", tint, 1,
+        "Warm (+) or cool (-) color tint", -1.0f, 1.0f, POINT_MATRIX, tint_matrix, NULL, NULL},
+    {"--blur", gaussian_blur, 1,
+        "Apply Gaussian blur", 1.0f, 10.0f, POINT_NONE, NULL, gaussian_blur_radius, gaussian_blur_planar},
+    {"--iir-blur", iir_gaussian_blur, 1,
+        "Apply recursive Gaussian blur, same cost for any sigma", 1.0f, 250.0f, POINT_NONE, NULL, NULL, NULL},
+    {"--edge", edge_detect, 1,
+        "Apply edge detection", 0.0f, 255.0f, POINT_NONE, NULL, edge_detect_radius, edge_detect_planar},
+    {"--canny", canny_edge_detect, 1,
+        "Apply Canny edge detection", 20.0f, 200.0f, POINT_NONE, NULL, NULL, NULL}
+
+};
+
+const int num_filters = sizeof(filter) / sizeof(Filter);
+
+const Filter *find_filter(const char *name) {
+    for (int i = 0; i < num_filters; i++) {
+        if (strcmp(name, filter[i].name) == 0) {
+            return &filter[i];
+        }
+    }
+    return NULL;
+}
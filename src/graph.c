@@ -0,0 +1,197 @@
+#include "graph.h"
+#include "pipeline.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int input;
+    const Filter *filter;
+    float param;
+    int requested;
+    int live;
+    int consumers;
+    int computed;
+    Image buffer;
+} GraphNode;
+
+struct FilterGraph {
+    GraphNode *nodes;
+    int num_nodes;
+    int capacity;
+};
+
+FilterGraph *graph_create(Image *image) {
+    FilterGraph *graph = (FilterGraph *)calloc(1, sizeof(FilterGraph));
+    if (!graph) {
+        return NULL;
+    }
+
+    graph->capacity = 16;
+    graph->nodes = (GraphNode *)calloc(graph->capacity, sizeof(GraphNode));
+    if (!graph->nodes) {
+        free(graph);
+        return NULL;
+    }
+
+    GraphNode *source = &graph->nodes[GRAPH_SOURCE];
+    source->input = -1;
+    source->computed = 1;
+    source->buffer = *image;
+    image->flags &= ~IMAGE_OWNED;
+    graph->num_nodes = 1;
+
+    return graph;
+}
+
+void graph_free(FilterGraph *graph) {
+    if (!graph) {
+        return;
+    }
+
+    for (int i = 0; i < graph->num_nodes; i++) {
+        image_free(&graph->nodes[i].buffer);
+    }
+    free(graph->nodes);
+    free(graph);
+}
+
+int graph_add(FilterGraph *graph, int input, const Filter *filter, float param) {
+    if (input < 0 || input >= graph->num_nodes) {
+        return -1;
+    }
+
+    for (int i = input + 1; i < graph->num_nodes; i++) {
+        const GraphNode *node = &graph->nodes[i];
+        if (node->input == input && node->filter == filter && node->param == param) {
+            return i;
+        }
+    }
+
+    if (graph->num_nodes == graph->capacity) {
+        GraphNode *nodes = (GraphNode *)realloc(graph->nodes, 2 * graph->capacity * sizeof(GraphNode));
+        if (!nodes) {
+            return -1;
+        }
+        graph->nodes = nodes;
+        graph->capacity *= 2;
+    }
+
+    GraphNode *node = &graph->nodes[graph->num_nodes];
+    memset(node, 0, sizeof(GraphNode));
+    node->input = input;
+    node->filter = filter;
+    node->param = param;
+
+    return graph->num_nodes++;
+}
+
+void graph_request(FilterGraph *graph, int node) {
+    if (node >= 0 && node < graph->num_nodes) {
+        graph->nodes[node].requested = 1;
+    }
+}
+
+const Image *graph_output(const FilterGraph *graph, int node) {
+    if (node < 0 || node >= graph->num_nodes || !graph->nodes[node].requested || !graph->nodes[node].buffer.data) {
+        return NULL;
+    }
+    return &graph->nodes[node].buffer;
+}
+
+static int single_consumer(const FilterGraph *graph, int node) {
+    for (int i = node + 1; i < graph->num_nodes; i++) {
+        if (graph->nodes[i].live && graph->nodes[i].input == node) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Hands the input buffer to a consumer: the last reader takes it, earlier readers get a copy.
+static int take_input(FilterGraph *graph, int input, Image *buffer) {
+    GraphNode *node = &graph->nodes[input];
+    int ok = 1;
+
+    if (node->consumers == 1) {
+        *buffer = node->buffer;
+        node->buffer.data = NULL;
+        node->buffer.flags = 0;
+    } else {
+        ok = image_clone(buffer, &node->buffer);
+    }
+
+    node->consumers--;
+    return ok;
+}
+
+int graph_evaluate(FilterGraph *graph) {
+    // Inputs always have smaller ids, so one backwards sweep finds everything an output needs.
+    for (int i = graph->num_nodes - 1; i >= 0; i--) {
+        GraphNode *node = &graph->nodes[i];
+        node->live = node->live || node->requested;
+        node->consumers = node->requested ? 1 : 0;
+        if (node->live && node->input >= 0) {
+            graph->nodes[node->input].live = 1;
+        }
+    }
+
+    for (int i = 1; i < graph->num_nodes; i++) {
+        if (graph->nodes[i].live) {
+            graph->nodes[graph->nodes[i].input].consumers++;
+        }
+    }
+
+    GraphNode *source = &graph->nodes[GRAPH_SOURCE];
+    if (source->consumers == 0) {
+        image_free(&source->buffer);
+    }
+
+    ChainStep *steps = (ChainStep *)malloc(graph->num_nodes * sizeof(ChainStep));
+    if (!steps) {
+        return 0;
+    }
+
+    int ok = 1;
+    for (int i = 1; i < graph->num_nodes && ok; i++) {
+        if (!graph->nodes[i].live || graph->nodes[i].computed) {
+            continue;
+        }
+
+        // Extend the run while the intermediate result has no other reader.
+        int num_steps = 0;
+        int last = i;
+        for (;;) {
+            steps[num_steps].filter = graph->nodes[last].filter;
+            steps[num_steps].param = graph->nodes[last].param;
+            num_steps++;
+            graph->nodes[last].computed = 1;
+
+            if (graph->nodes[last].requested || graph->nodes[last].consumers != 1) break;
+            last = single_consumer(graph, last);
+        }
+
+        Image buffer;
+        if (!take_input(graph, graph->nodes[i].input, &buffer)) {
+            ok = 0;
+            break;
+        }
+
+        ChainPlan plan;
+        if (!chain_plan(&plan, steps, num_steps, buffer.channels, use_fixed_point)) {
+            image_free(&buffer);
+            ok = 0;
+            break;
+        }
+
+        chain_run(&plan, &buffer);
+        chain_free(&plan);
+
+        graph->nodes[last].buffer = buffer;
+        if (graph->nodes[last].consumers == 0) {
+            image_free(&graph->nodes[last].buffer);
+        }
+    }
+
+    free(steps);
+    return ok;
+}
@@ -0,0 +1,518 @@
+#include "image_utils.h"
+#include "kernels.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+static size_t aligned_stride(size_t row_size) {
+    return (row_size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+}
+
+typedef enum {
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_THP,      // transparent huge pages only
+    HUGE_PAGES_AUTO      // the hugetlbfs pool while it has pages, then transparent huge pages
+} HugePageMode;
+
+static HugePageMode huge_page_mode = HUGE_PAGES_AUTO;
+
+// Live bytes of image buffers in hugetlbfs pages and advised for transparent huge pages.
+static size_t hugetlb_bytes;
+static size_t advised_bytes;
+
+#ifdef __linux__
+// IMG_ED_HUGE_PAGES=off|thp weakens the default, e.g. to compare page faults and dTLB misses.
+__attribute__((constructor))
+static void select_huge_pages(void) {
+    const char *mode = getenv("IMG_ED_HUGE_PAGES");
+    if (mode && strcmp(mode, "off") == 0) huge_page_mode = HUGE_PAGES_OFF;
+    else if (mode && strcmp(mode, "thp") == 0) huge_page_mode = HUGE_PAGES_THP;
+}
+#endif
+
+/*
+ * Every image buffer starts IMAGE_ALIGN bytes into its allocation, behind
+ * a header that says how it was made and how to give it back.
+ */
+typedef struct {
+    void *base;       // what to free or unmap
+    size_t size;      // bytes usable after the header
+    size_t mapped;    // length of the mapping, 0 on the heap
+    size_t huge;      // bytes counted in hugetlb_bytes or advised_bytes
+    int hugetlb;
+} BufferHeader;
+
+static BufferHeader *buffer_header(void *data) {
+    return (BufferHeader *)((unsigned char *)data - IMAGE_ALIGN);
+}
+
+#ifdef __linux__
+/**
+ * Maps length bytes, a multiple of HUGE_PAGE_SIZE, for a big buffer:
+ * from the hugetlbfs pool if it has pages, otherwise as anonymous memory
+ * starting on a huge page boundary and advised for transparent huge pages,
+ * which the kernel may still back with small pages. NULL if mmap fails.
+ */
+static unsigned char *map_huge(size_t length, BufferHeader *header) {
+    if (huge_page_mode == HUGE_PAGES_AUTO) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+        flags |= 21 << MAP_HUGE_SHIFT;  // 2 MiB pages even where the default size is 1 GiB
+#endif
+        void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (map != MAP_FAILED) {
+            header->base = map;
+            header->mapped = length;
+            header->huge = length;
+            header->hugetlb = 1;
+            return (unsigned char *)map;
+        }
+    }
+
+    // one huge page more, so the buffer can start on a huge page boundary
+    void *map = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    unsigned char *start = (unsigned char *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    header->base = map;
+    header->mapped = length + HUGE_PAGE_SIZE;
+#ifdef MADV_HUGEPAGE
+    if (madvise(start, length, MADV_HUGEPAGE) == 0) {
+        header->huge = length;
+    }
+#endif
+    return start;
+}
+#endif
+
+/*
+ * place hands a fresh mapping to numa_place before anything writes to it.
+ * Scratch blocks skip that: the filter loops that fill them first already
+ * split rows between threads the same way, and a worker's own tiles
+ * should stay on its node.
+ */
+static void *buffer_alloc(size_t size, int place) {
+    BufferHeader header = {NULL, size, 0, 0, 0};
+    unsigned char *base = NULL;
+
+#ifdef __linux__
+    if (size >= HUGE_PAGE_SIZE && huge_page_mode != HUGE_PAGES_OFF) {
+        const size_t length = (size + IMAGE_ALIGN + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        base = map_huge(length, &header);
+        if (base && place) {
+            numa_place(base, length);
+        }
+    }
+#endif
+
+    if (!base) {
+#ifdef _WIN32
+        base = (unsigned char *)_aligned_malloc(aligned_stride(size) + IMAGE_ALIGN, IMAGE_ALIGN);
+#else
+        base = (unsigned char *)aligned_alloc(IMAGE_ALIGN, aligned_stride(size) + IMAGE_ALIGN);
+#endif
+        if (!base) {
+            return NULL;
+        }
+        header.base = base;
+    }
+
+    if (header.hugetlb) {
+        #pragma omp atomic
+        hugetlb_bytes += header.huge;
+    } else if (header.huge) {
+        #pragma omp atomic
+        advised_bytes += header.huge;
+    }
+
+    memcpy(base, &header, sizeof(header));
+    return base + IMAGE_ALIGN;
+}
+
+/**
+ * Allocates size bytes for pixels, IMAGE_ALIGN aligned. Buffers of
+ * HUGE_PAGE_SIZE and more get a mapping of their own backed by huge pages
+ * where the system has them, which keeps column and multi-row access from
+ * missing the TLB on big images, and placed on NUMA nodes by numa_place;
+ * smaller ones come from the heap. Release with image_buffer_free, never
+ * free.
+ */
+void *image_buffer_alloc(size_t size) {
+    return buffer_alloc(size, 1);
+}
+
+// Same contents up to the smaller size in a new buffer, like realloc.
+void *image_buffer_realloc(void *data, size_t size) {
+    if (!data) {
+        return image_buffer_alloc(size);
+    }
+
+    const size_t old_size = buffer_header(data)->size;
+    if (size <= old_size) {
+        return data;
+    }
+
+    void *grown = image_buffer_alloc(size);
+    if (!grown) {
+        return NULL;
+    }
+    memcpy(grown, data, old_size);
+    image_buffer_free(data);
+    return grown;
+}
+
+void image_buffer_free(void *data) {
+    if (!data) {
+        return;
+    }
+
+    const BufferHeader header = *buffer_header(data);
+    if (header.hugetlb) {
+        #pragma omp atomic
+        hugetlb_bytes -= header.huge;
+    } else if (header.huge) {
+        #pragma omp atomic
+        advised_bytes -= header.huge;
+    }
+
+#ifdef __linux__
+    if (header.mapped) {
+        munmap(header.base, header.mapped);
+        return;
+    }
+#endif
+#ifdef _WIN32
+    _aligned_free(header.base);
+#else
+    free(header.base);
+#endif
+}
+
+/**
+ * Live image and scratch bytes in hugetlbfs pages and advised for
+ * transparent huge pages, and how much of the process's anonymous memory
+ * the kernel backs with them. The kernel figures are 0 and the result is
+ * 0 where /proc/self/smaps_rollup cannot be read.
+ */
+int huge_page_stats(HugePageStats *stats) {
+    memset(stats, 0, sizeof(HugePageStats));
+    #pragma omp atomic read
+    stats->hugetlb = hugetlb_bytes;
+    #pragma omp atomic read
+    stats->advised = advised_bytes;
+
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) {
+        return 0;
+    }
+
+    char line[256];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "Anonymous: %llu kB", &kb) == 1) stats->anonymous = (size_t)kb * 1024;
+        else if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1) stats->anon_huge = (size_t)kb * 1024;
+    }
+    fclose(file);
+    return 1;
+}
+
+// Bytes an image_alloc or image_alloc_planar image of this size takes.
+static size_t image_bytes(int width, int height, int channels, int planar) {
+    const int rows = (height > 0) ? height : 1;
+    return planar ? aligned_stride((size_t)width) * rows * channels
+                  : aligned_stride((size_t)width * channels) * rows;
+}
+
+// Lays an image_alloc or image_alloc_planar image out over data.
+static void image_layout(Image *image, unsigned char *data, int width, int height, int channels, int planar, int flags) {
+    image->data = data;
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    if (planar) {
+        image->stride = aligned_stride((size_t)width);
+        image->plane_size = image->stride * ((height > 0) ? height : 1);
+        image->flags = flags | IMAGE_ALIGNED | IMAGE_PLANAR;
+    } else {
+        image->stride = aligned_stride((size_t)width * channels);
+        image->plane_size = 0;
+        image->flags = flags | IMAGE_ALIGNED;
+    }
+}
+
+/**
+ * Allocates an uninitialised width x height image whose rows each start on
+ * an IMAGE_ALIGN boundary. The padding at the end of a row is never read
+ * as pixels, so kernels may run full vectors into it.
+ */
+int image_alloc(Image *image, int width, int height, int channels) {
+    unsigned char *data = (unsigned char *)image_buffer_alloc(image_bytes(width, height, channels, 0));
+    if (!data) {
+        memset(image, 0, sizeof(Image));
+        return 0;
+    }
+
+    image_layout(image, data, width, height, channels, 0, IMAGE_OWNED);
+    return 1;
+}
+
+// Same as image_alloc, but one aligned plane per channel.
+int image_alloc_planar(Image *image, int width, int height, int channels) {
+    unsigned char *data = (unsigned char *)image_buffer_alloc(image_bytes(width, height, channels, 1));
+    if (!data) {
+        memset(image, 0, sizeof(Image));
+        return 0;
+    }
+
+    image_layout(image, data, width, height, channels, 1, IMAGE_OWNED);
+    return 1;
+}
+
+/**
+ * The calling thread's scratch arena. Allocations are carved from one
+ * block in order; one that does not fit gets a block of its own, a spill.
+ * When the arena is empty again after spilling, the block is replaced by
+ * one of the high-water size, so from then on the same work runs without
+ * allocating, on pages that are already mapped.
+ */
+typedef struct {
+    unsigned char *block;
+    size_t capacity;
+    size_t used;
+    size_t spilled;      // bytes in spills
+    size_t high_water;   // most of used + spilled at once
+    unsigned char **spills;
+    int num_spills;
+    int max_spills;
+} ScratchArena;
+
+static _Thread_local ScratchArena scratch;
+
+ScratchMark scratch_mark(void) {
+    ScratchMark mark = {scratch.used, scratch.spilled, scratch.num_spills};
+    return mark;
+}
+
+void *scratch_alloc(size_t size) {
+    size = aligned_stride(size ? size : 1);
+    unsigned char *data;
+
+    if (scratch.capacity - scratch.used >= size) {
+        data = scratch.block + scratch.used;
+        scratch.used += size;
+    } else {
+        if (scratch.num_spills == scratch.max_spills) {
+            const int max_spills = scratch.max_spills ? 2 * scratch.max_spills : 8;
+            unsigned char **spills = (unsigned char **)realloc(scratch.spills, max_spills * sizeof(unsigned char *));
+            if (!spills) {
+                return NULL;
+            }
+            scratch.spills = spills;
+            scratch.max_spills = max_spills;
+        }
+        data = (unsigned char *)buffer_alloc(size, 0);
+        if (!data) {
+            return NULL;
+        }
+        scratch.spills[scratch.num_spills++] = data;
+        scratch.spilled += size;
+    }
+
+    if (scratch.used + scratch.spilled > scratch.high_water) {
+        scratch.high_water = scratch.used + scratch.spilled;
+    }
+    return data;
+}
+
+// Like image_alloc_planar or image_alloc, but from the scratch arena; image_free leaves it alone.
+int scratch_image(Image *image, int width, int height, int channels, int planar) {
+    unsigned char *data = (unsigned char *)scratch_alloc(image_bytes(width, height, channels, planar));
+    if (!data) {
+        memset(image, 0, sizeof(Image));
+        return 0;
+    }
+
+    image_layout(image, data, width, height, channels, planar, 0);
+    return 1;
+}
+
+void scratch_release(ScratchMark mark) {
+    while (scratch.num_spills > mark.spills) {
+        image_buffer_free(scratch.spills[--scratch.num_spills]);
+    }
+    scratch.used = mark.used;
+    scratch.spilled = mark.spilled;
+
+    if (scratch.used == 0 && scratch.high_water > scratch.capacity) {
+        image_buffer_free(scratch.block);
+        scratch.block = (unsigned char *)buffer_alloc(scratch.high_water, 0);
+        scratch.capacity = scratch.block ? scratch.high_water : 0;
+    }
+}
+
+void scratch_free(void) {
+    while (scratch.num_spills > 0) {
+        image_buffer_free(scratch.spills[--scratch.num_spills]);
+    }
+    image_buffer_free(scratch.block);
+    free(scratch.spills);
+    memset(&scratch, 0, sizeof(scratch));
+}
+
+// Tightly packed rows, e.g. a buffer from stbi_load. IMAGE_OWNED hands it to image_free, so it must come from image_buffer_alloc.
+Image image_wrap(unsigned char *data, int width, int height, int channels, int flags) {
+    Image image;
+    image.data = data;
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.stride = (size_t)width * channels;
+    image.plane_size = 0;
+    image.flags = flags & IMAGE_OWNED;
+    return image;
+}
+
+// Zero-copy view of a rectangle; it borrows the parent's pixels and must not outlive them.
+Image image_crop(const Image *image, int x, int y, int width, int height) {
+    const int planar = (image->flags & IMAGE_PLANAR) != 0;
+
+    Image view;
+    view.data = image_row(image, y) + (size_t)x * (planar ? 1 : image->channels);
+    view.width = width;
+    view.height = height;
+    view.channels = image->channels;
+    view.stride = image->stride;
+    view.plane_size = image->plane_size;
+    view.flags = image->flags & IMAGE_PLANAR;
+    return view;
+}
+
+static void convert_row(Image *dst, const Image *src, int y) {
+    unsigned char *planes[4];
+
+    if (src->flags & IMAGE_PLANAR) {
+        for (int c = 0; c < src->channels; c++) planes[c] = image_plane_row(src, c, y);
+        kernels->interleave_row(planes, image_row(dst, y), src->width, src->channels);
+    } else {
+        for (int c = 0; c < src->channels; c++) planes[c] = image_plane_row(dst, c, y);
+        kernels->deinterleave_row(image_row(src, y), planes, src->width, src->channels);
+    }
+}
+
+/**
+ * Copies pixels between images of the same size; strides may differ.
+ * Copying between an interleaved and a planar image converts the layout,
+ * so tiles and bands change layout in the copy they already make.
+ */
+void image_copy(Image *dst, const Image *src) {
+    const int src_planar = (src->flags & IMAGE_PLANAR) != 0;
+    const int dst_planar = (dst->flags & IMAGE_PLANAR) != 0;
+
+    if (src_planar != dst_planar) {
+        if (USE_THREADS_FOR(src->width * src->height)) {
+            #pragma omp parallel for schedule(static)
+            for (int y = 0; y < src->height; y++) {
+                convert_row(dst, src, y);
+            }
+        } else {
+            for (int y = 0; y < src->height; y++) {
+                convert_row(dst, src, y);
+            }
+        }
+        return;
+    }
+
+    const size_t row_size = (size_t)src->width * (src_planar ? 1 : src->channels);
+    const int num_planes = src_planar ? src->channels : 1;
+
+    for (int c = 0; c < num_planes; c++) {
+        const unsigned char *from = src->data + c * src->plane_size;
+        unsigned char *to = dst->data + c * dst->plane_size;
+
+        if (dst->stride == src->stride && row_size == src->stride) {
+            memcpy(to, from, row_size * src->height);
+            continue;
+        }
+
+        for (int y = 0; y < src->height; y++) {
+            memcpy(to + (size_t)y * dst->stride, from + (size_t)y * src->stride, row_size);
+        }
+    }
+}
+
+// channels is a constant at every call, so each case compiles to plain byte moves.
+static inline void transpose_pixels(Image *dst, const Image *src, int x0, int x1, int y0, int y1, const int channels) {
+    for (int x = x0; x < x1; x++) {
+        unsigned char *to = image_row(dst, x);
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *from = image_row(src, y) + (size_t)x * channels;
+            for (int c = 0; c < channels; c++) {
+                to[(size_t)y * channels + c] = from[c];
+            }
+        }
+    }
+}
+
+static void transpose_block(Image *dst, const Image *src, int x0, int y0) {
+    const int x1 = (x0 + TRANSPOSE_BLOCK < src->width) ? x0 + TRANSPOSE_BLOCK : src->width;
+    const int y1 = (y0 + TRANSPOSE_BLOCK < src->height) ? y0 + TRANSPOSE_BLOCK : src->height;
+
+    switch (src->channels) {
+        case 1: transpose_pixels(dst, src, x0, x1, y0, y1, 1); break;
+        case 2: transpose_pixels(dst, src, x0, x1, y0, y1, 2); break;
+        case 3: transpose_pixels(dst, src, x0, x1, y0, y1, 3); break;
+        default: transpose_pixels(dst, src, x0, x1, y0, y1, 4); break;
+    }
+}
+
+/**
+ * dst = src with rows and columns swapped; dst must be src->height wide and
+ * src->width tall, interleaved, with the same channel count. Runs in
+ * square blocks so both sides stay in cache.
+ */
+void image_transpose(Image *dst, const Image *src) {
+    const int blocks_x = (src->width + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+    const int blocks_y = (src->height + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+
+    if (USE_THREADS_FOR(src->width * src->height)) {
+        #pragma omp parallel for schedule(static)
+        for (int by = 0; by < blocks_y; by++) {
+            for (int bx = 0; bx < blocks_x; bx++) {
+                transpose_block(dst, src, bx * TRANSPOSE_BLOCK, by * TRANSPOSE_BLOCK);
+            }
+        }
+    } else {
+        for (int by = 0; by < blocks_y; by++) {
+            for (int bx = 0; bx < blocks_x; bx++) {
+                transpose_block(dst, src, bx * TRANSPOSE_BLOCK, by * TRANSPOSE_BLOCK);
+            }
+        }
+    }
+}
+
+int image_clone(Image *dst, const Image *src) {
+    const int ok = (src->flags & IMAGE_PLANAR)
+                   ? image_alloc_planar(dst, src->width, src->height, src->channels)
+                   : image_alloc(dst, src->width, src->height, src->channels);
+    if (!ok) {
+        return 0;
+    }
+    image_copy(dst, src);
+    return 1;
+}
+
+void image_free(Image *image) {
+    if (image->flags & IMAGE_OWNED) {
+        image_buffer_free(image->data);
+    }
+    image->data = NULL;
+    image->flags = 0;
+}
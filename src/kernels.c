@@ -0,0 +1,1620 @@
+#include "kernels.h"
+#include "image_utils.h"
+#include <string.h>
+#include <stdlib.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+ * Row kernels behind the KernelTable in kernels.h. This file is compiled
+ * once per instruction set with KERNEL_ISA naming the variant; the
+ * __AVX2__ and __AVX512BW__ paths are picked up from the compiler flags of
+ * each build, and every variant produces the same bytes as the scalar code.
+ */
+#ifndef KERNEL_ISA
+#define KERNEL_ISA generic
+#endif
+
+#ifdef __AVX2__
+static inline __m256 matrix_dot(__m256 r, __m256 g, __m256 b, const float m[4]) {
+    __m256 acc = _mm256_mul_ps(_mm256_set1_ps(m[0]), r);
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(m[1]), g));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(m[2]), b));
+    return _mm256_add_ps(acc, _mm256_set1_ps(m[3] + 0.5f));
+}
+
+// Truncates and saturates 8 floats to bytes, same as CLAMP + cast in the scalar path.
+static inline __m128i matrix_pack(__m256 v) {
+    const __m256i i32 = _mm256_cvttps_epi32(v);
+    const __m128i i16 = _mm_packs_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+    return _mm_packus_epi16(i16, i16);
+}
+
+static int color_matrix_row_rgb_avx2(unsigned char *row, int width, const float m[3][4]) {
+    // 8 pixels = 24 bytes, read as two overlapping 16-byte loads at 0 and 8
+    const __m128i r_lo = _mm_setr_epi8(0, 3, 6, 9, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_lo = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_lo = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    // rg holds R in bytes 0-7 and G in bytes 8-15, b holds B in bytes 0-7
+    const __m128i out0_rg = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+    const __m128i out0_b = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i out1_rg = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i out1_b = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 3;
+        const __m128i lo = _mm_loadu_si128((const __m128i *)p);
+        const __m128i hi = _mm_loadu_si128((const __m128i *)(p + 8));
+
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_or_si128(_mm_shuffle_epi8(lo, r_lo), _mm_shuffle_epi8(hi, r_hi))));
+        const __m256 g = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_or_si128(_mm_shuffle_epi8(lo, g_lo), _mm_shuffle_epi8(hi, g_hi))));
+        const __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_or_si128(_mm_shuffle_epi8(lo, b_lo), _mm_shuffle_epi8(hi, b_hi))));
+
+        const __m128i out_r = matrix_pack(matrix_dot(r, g, b, m[0]));
+        const __m128i out_g = matrix_pack(matrix_dot(r, g, b, m[1]));
+        const __m128i out_b = matrix_pack(matrix_dot(r, g, b, m[2]));
+
+        const __m128i rg = _mm_unpacklo_epi64(out_r, out_g);
+        const __m128i out0 = _mm_or_si128(_mm_shuffle_epi8(rg, out0_rg), _mm_shuffle_epi8(out_b, out0_b));
+        const __m128i out1 = _mm_or_si128(_mm_shuffle_epi8(rg, out1_rg), _mm_shuffle_epi8(out_b, out1_b));
+
+        _mm_storeu_si128((__m128i *)p, out0);
+        _mm_storel_epi64((__m128i *)(p + 16), out1);
+    }
+
+    return x;
+}
+
+static int color_matrix_row_rgba_avx2(unsigned char *row, int width, const float m[3][4]) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i zero = _mm256_setzero_si256();
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 4;
+        const __m256i px = _mm256_loadu_si256((const __m256i *)p);
+
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(px, byte_mask));
+        const __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), byte_mask));
+        const __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), byte_mask));
+
+        const __m256i out_r = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(matrix_dot(r, g, b, m[0])), zero), byte_mask);
+        const __m256i out_g = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(matrix_dot(r, g, b, m[1])), zero), byte_mask);
+        const __m256i out_b = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(matrix_dot(r, g, b, m[2])), zero), byte_mask);
+
+        __m256i out = _mm256_and_si256(px, alpha_mask);
+        out = _mm256_or_si256(out, out_r);
+        out = _mm256_or_si256(out, _mm256_slli_epi32(out_g, 8));
+        out = _mm256_or_si256(out, _mm256_slli_epi32(out_b, 16));
+
+        _mm256_storeu_si256((__m256i *)p, out);
+    }
+
+    return x;
+}
+
+// Matrices with three equal rows (grayscale) need one dot product per pixel, copied to R, G and B.
+static int color_matrix_row_gray_rgb_avx2(unsigned char *row, int width, const float m[3][4]) {
+    const __m128i r_lo = _mm_setr_epi8(0, 3, 6, 9, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_lo = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_lo = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    const __m128i out0_gray = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i out1_gray = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 3;
+        const __m128i lo = _mm_loadu_si128((const __m128i *)p);
+        const __m128i hi = _mm_loadu_si128((const __m128i *)(p + 8));
+
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_or_si128(_mm_shuffle_epi8(lo, r_lo), _mm_shuffle_epi8(hi, r_hi))));
+        const __m256 g = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_or_si128(_mm_shuffle_epi8(lo, g_lo), _mm_shuffle_epi8(hi, g_hi))));
+        const __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+            _mm_or_si128(_mm_shuffle_epi8(lo, b_lo), _mm_shuffle_epi8(hi, b_hi))));
+
+        const __m128i gray = matrix_pack(matrix_dot(r, g, b, m[0]));
+
+        _mm_storeu_si128((__m128i *)p, _mm_shuffle_epi8(gray, out0_gray));
+        _mm_storel_epi64((__m128i *)(p + 16), _mm_shuffle_epi8(gray, out1_gray));
+    }
+
+    return x;
+}
+
+static int color_matrix_row_gray_rgba_avx2(unsigned char *row, int width, const float m[3][4]) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i zero = _mm256_setzero_si256();
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 4;
+        const __m256i px = _mm256_loadu_si256((const __m256i *)p);
+
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(px, byte_mask));
+        const __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), byte_mask));
+        const __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), byte_mask));
+
+        const __m256i gray = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(matrix_dot(r, g, b, m[0])), zero), byte_mask);
+
+        __m256i out = _mm256_and_si256(px, alpha_mask);
+        out = _mm256_or_si256(out, _mm256_mullo_epi32(gray, _mm256_set1_epi32(0x010101)));
+
+        _mm256_storeu_si256((__m256i *)p, out);
+    }
+
+    return x;
+}
+#endif
+
+static void matrix_row(unsigned char *row, int width, int channels, const float m[3][4]) {
+    int x = 0;
+
+#ifdef __AVX2__
+    const int gray = memcmp(m[0], m[1], sizeof(m[0])) == 0 && memcmp(m[0], m[2], sizeof(m[0])) == 0;
+
+    if (gray && channels == 3) {
+        x = color_matrix_row_gray_rgb_avx2(row, width, m);
+    } else if (gray && channels == 4) {
+        x = color_matrix_row_gray_rgba_avx2(row, width, m);
+    } else if (channels == 3) {
+        x = color_matrix_row_rgb_avx2(row, width, m);
+    } else if (channels == 4) {
+        x = color_matrix_row_rgba_avx2(row, width, m);
+    }
+#endif
+
+    for (; x < width; x++) {
+        const int idx = x * channels;
+        const int r = row[idx];
+        const int g = row[idx + 1];
+        const int b = row[idx + 2];
+
+        const int out_r = CLAMP(m[0][0] * r + m[0][1] * g + m[0][2] * b + (m[0][3] + 0.5f));
+        const int out_g = CLAMP(m[1][0] * r + m[1][1] * g + m[1][2] * b + (m[1][3] + 0.5f));
+        const int out_b = CLAMP(m[2][0] * r + m[2][1] * g + m[2][2] * b + (m[2][3] + 0.5f));
+
+        row[idx] = (unsigned char)out_r;
+        row[idx + 1] = (unsigned char)out_g;
+        row[idx + 2] = (unsigned char)out_b;
+    }
+}
+
+// matrix_row for IMAGE_PLANAR images: the channels are already split, so no shuffles are needed.
+static void matrix_planar_row(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width, const float m[3][4]) {
+    int x = 0;
+
+#ifdef __AVX2__
+    for (; x + 8 <= width; x += 8) {
+        const __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(r_row + x))));
+        const __m256 g = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(g_row + x))));
+        const __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(b_row + x))));
+
+        _mm_storel_epi64((__m128i *)(r_row + x), matrix_pack(matrix_dot(r, g, b, m[0])));
+        _mm_storel_epi64((__m128i *)(g_row + x), matrix_pack(matrix_dot(r, g, b, m[1])));
+        _mm_storel_epi64((__m128i *)(b_row + x), matrix_pack(matrix_dot(r, g, b, m[2])));
+    }
+#endif
+
+    for (; x < width; x++) {
+        const int r = r_row[x];
+        const int g = g_row[x];
+        const int b = b_row[x];
+
+        r_row[x] = (unsigned char)CLAMP(m[0][0] * r + m[0][1] * g + m[0][2] * b + (m[0][3] + 0.5f));
+        g_row[x] = (unsigned char)CLAMP(m[1][0] * r + m[1][1] * g + m[1][2] * b + (m[1][3] + 0.5f));
+        b_row[x] = (unsigned char)CLAMP(m[2][0] * r + m[2][1] * g + m[2][2] * b + (m[2][3] + 0.5f));
+    }
+}
+
+/*
+ * Q12 colour matrix for use_fixed_point: m[i][0..2] are FIXED_ONE-scaled
+ * coefficients and m[i][3] the scaled offset, and each channel is
+ * CLAMP(FIXED_ROUND(m0 * r + m1 * g + m2 * b + m3)). Integer only, so the
+ * vector paths and the scalar tail agree exactly.
+ */
+static inline unsigned char fixed_channel(const int m[4], int r, int g, int b) {
+    return (unsigned char)CLAMP(FIXED_ROUND(m[0] * r + m[1] * g + m[2] * b + m[3]));
+}
+
+#ifdef __AVX2__
+// One output channel for 8 pixels; rb holds r | b << 16 and g holds g in each 32-bit lane, for pmaddwd.
+static inline __m256i fixed_dot(__m256i rb, __m256i g, const int m[4]) {
+    const __m256i c02 = _mm256_set1_epi32((int)(((unsigned)m[2] << 16) | ((unsigned)m[0] & 0xFFFF)));
+    const __m256i c1 = _mm256_set1_epi32(m[1] & 0xFFFF);
+    const __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(rb, c02), _mm256_madd_epi16(g, c1));
+    return _mm256_srai_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(m[3] + (FIXED_ONE >> 1))), FIXED_SHIFT);
+}
+
+// Saturates 8 int32 to bytes, in the low 8 bytes.
+static inline __m128i fixed_pack(__m256i v) {
+    const __m128i i16 = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_packus_epi16(i16, i16);
+}
+
+static int color_matrix_fixed_row_rgb_avx2(unsigned char *row, int width, const int m[3][4]) {
+    const __m128i r_lo = _mm_setr_epi8(0, 3, 6, 9, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_lo = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_lo = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    const __m128i out0_rg = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+    const __m128i out0_b = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i out1_rg = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i out1_b = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 3;
+        const __m128i lo = _mm_loadu_si128((const __m128i *)p);
+        const __m128i hi = _mm_loadu_si128((const __m128i *)(p + 8));
+
+        const __m256i r = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, r_lo), _mm_shuffle_epi8(hi, r_hi)));
+        const __m256i g = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, g_lo), _mm_shuffle_epi8(hi, g_hi)));
+        const __m256i b = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, b_lo), _mm_shuffle_epi8(hi, b_hi)));
+        const __m256i rb = _mm256_or_si256(r, _mm256_slli_epi32(b, 16));
+
+        const __m128i out_r = fixed_pack(fixed_dot(rb, g, m[0]));
+        const __m128i out_g = fixed_pack(fixed_dot(rb, g, m[1]));
+        const __m128i out_b = fixed_pack(fixed_dot(rb, g, m[2]));
+
+        const __m128i rg = _mm_unpacklo_epi64(out_r, out_g);
+        _mm_storeu_si128((__m128i *)p, _mm_or_si128(_mm_shuffle_epi8(rg, out0_rg), _mm_shuffle_epi8(out_b, out0_b)));
+        _mm_storel_epi64((__m128i *)(p + 16), _mm_or_si128(_mm_shuffle_epi8(rg, out1_rg), _mm_shuffle_epi8(out_b, out1_b)));
+    }
+
+    return x;
+}
+
+static int color_matrix_fixed_row_rgba_avx2(unsigned char *row, int width, const int m[3][4]) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i rb_mask = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i zero = _mm256_setzero_si256();
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 4;
+        const __m256i px = _mm256_loadu_si256((const __m256i *)p);
+
+        const __m256i rb = _mm256_and_si256(px, rb_mask);
+        const __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), byte_mask);
+
+        const __m256i out_r = _mm256_min_epi32(_mm256_max_epi32(fixed_dot(rb, g, m[0]), zero), byte_mask);
+        const __m256i out_g = _mm256_min_epi32(_mm256_max_epi32(fixed_dot(rb, g, m[1]), zero), byte_mask);
+        const __m256i out_b = _mm256_min_epi32(_mm256_max_epi32(fixed_dot(rb, g, m[2]), zero), byte_mask);
+
+        __m256i out = _mm256_and_si256(px, alpha_mask);
+        out = _mm256_or_si256(out, out_r);
+        out = _mm256_or_si256(out, _mm256_slli_epi32(out_g, 8));
+        out = _mm256_or_si256(out, _mm256_slli_epi32(out_b, 16));
+
+        _mm256_storeu_si256((__m256i *)p, out);
+    }
+
+    return x;
+}
+
+static int color_matrix_fixed_row_gray_rgb_avx2(unsigned char *row, int width, const int m[3][4]) {
+    const __m128i r_lo = _mm_setr_epi8(0, 3, 6, 9, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_lo = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_lo = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    const __m128i out0_gray = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i out1_gray = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 3;
+        const __m128i lo = _mm_loadu_si128((const __m128i *)p);
+        const __m128i hi = _mm_loadu_si128((const __m128i *)(p + 8));
+
+        const __m256i r = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, r_lo), _mm_shuffle_epi8(hi, r_hi)));
+        const __m256i g = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, g_lo), _mm_shuffle_epi8(hi, g_hi)));
+        const __m256i b = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, b_lo), _mm_shuffle_epi8(hi, b_hi)));
+
+        const __m128i gray = fixed_pack(fixed_dot(_mm256_or_si256(r, _mm256_slli_epi32(b, 16)), g, m[0]));
+
+        _mm_storeu_si128((__m128i *)p, _mm_shuffle_epi8(gray, out0_gray));
+        _mm_storel_epi64((__m128i *)(p + 16), _mm_shuffle_epi8(gray, out1_gray));
+    }
+
+    return x;
+}
+
+static int color_matrix_fixed_row_gray_rgba_avx2(unsigned char *row, int width, const int m[3][4]) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i rb_mask = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i zero = _mm256_setzero_si256();
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        unsigned char *p = row + x * 4;
+        const __m256i px = _mm256_loadu_si256((const __m256i *)p);
+
+        const __m256i rb = _mm256_and_si256(px, rb_mask);
+        const __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), byte_mask);
+        const __m256i gray = _mm256_min_epi32(_mm256_max_epi32(fixed_dot(rb, g, m[0]), zero), byte_mask);
+
+        __m256i out = _mm256_and_si256(px, alpha_mask);
+        out = _mm256_or_si256(out, _mm256_mullo_epi32(gray, _mm256_set1_epi32(0x010101)));
+
+        _mm256_storeu_si256((__m256i *)p, out);
+    }
+
+    return x;
+}
+#endif
+
+static void matrix_fixed_row(unsigned char *row, int width, int channels, const int m[3][4]) {
+    int x = 0;
+
+#ifdef __AVX2__
+    const int gray = memcmp(m[0], m[1], sizeof(m[0])) == 0 && memcmp(m[0], m[2], sizeof(m[0])) == 0;
+
+    if (gray && channels == 3) {
+        x = color_matrix_fixed_row_gray_rgb_avx2(row, width, m);
+    } else if (gray && channels == 4) {
+        x = color_matrix_fixed_row_gray_rgba_avx2(row, width, m);
+    } else if (channels == 3) {
+        x = color_matrix_fixed_row_rgb_avx2(row, width, m);
+    } else if (channels == 4) {
+        x = color_matrix_fixed_row_rgba_avx2(row, width, m);
+    }
+#endif
+
+    for (; x < width; x++) {
+        unsigned char *px = row + x * channels;
+        const int r = px[0];
+        const int g = px[1];
+        const int b = px[2];
+
+        px[0] = fixed_channel(m[0], r, g, b);
+        px[1] = fixed_channel(m[1], r, g, b);
+        px[2] = fixed_channel(m[2], r, g, b);
+    }
+}
+
+static void matrix_fixed_planar_row(unsigned char *r_row, unsigned char *g_row, unsigned char *b_row, int width, const int m[3][4]) {
+    int x = 0;
+
+#ifdef __AVX2__
+    for (; x + 8 <= width; x += 8) {
+        const __m256i r = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(r_row + x)));
+        const __m256i g = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(g_row + x)));
+        const __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(b_row + x)));
+        const __m256i rb = _mm256_or_si256(r, _mm256_slli_epi32(b, 16));
+
+        _mm_storel_epi64((__m128i *)(r_row + x), fixed_pack(fixed_dot(rb, g, m[0])));
+        _mm_storel_epi64((__m128i *)(g_row + x), fixed_pack(fixed_dot(rb, g, m[1])));
+        _mm_storel_epi64((__m128i *)(b_row + x), fixed_pack(fixed_dot(rb, g, m[2])));
+    }
+#endif
+
+    for (; x < width; x++) {
+        const int r = r_row[x];
+        const int g = g_row[x];
+        const int b = b_row[x];
+
+        r_row[x] = fixed_channel(m[0], r, g, b);
+        g_row[x] = fixed_channel(m[1], r, g, b);
+        b_row[x] = fixed_channel(m[2], r, g, b);
+    }
+}
+
+#ifdef __AVX512BW__
+static inline __m512 widen_bytes(const unsigned char *p) {
+    return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)p)));
+}
+
+// Truncates 16 floats already clamped to [0, 255] and stores them as bytes.
+static inline void narrow_bytes(unsigned char *p, __m512 v) {
+    _mm_storeu_si128((__m128i *)p, _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(v)));
+}
+#endif
+
+#ifdef __AVX2__
+// Truncates 32 floats (bytes 0-7, 8-15, 16-23, 24-31 of a row) back to bytes,
+// saturating to [0, 255] like the scalar clamps.
+static inline __m256i pack_bytes(__m256 a, __m256 b, __m256 c, __m256 d) {
+    const __m256i ab = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+    const __m256i cd = _mm256_packs_epi32(_mm256_cvttps_epi32(c), _mm256_cvttps_epi32(d));
+    // packs work per 128-bit lane, so the 4-byte groups come out as a0 b0 c0 d0 | a1 b1 c1 d1
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(ab, cd), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+// Widens 32 bytes to four vectors of 8 floats.
+static inline void unpack_bytes(__m256i px, __m256 out[4]) {
+    const __m128i lo = _mm256_castsi256_si128(px);
+    const __m128i hi = _mm256_extracti128_si256(px, 1);
+
+    out[0] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(lo));
+    out[1] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+    out[2] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(hi));
+    out[3] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+}
+#endif
+
+// Alpha, the fourth byte of an RGBA pixel, is kept; every other byte is inverted.
+static void invert_row(unsigned char *row, int width, int channels) {
+    const int size = width * channels;
+    int i = 0;
+
+#ifdef __AVX512BW__
+    const __m512i wide_mask = (channels == 4) ? _mm512_set1_epi32(0x00FFFFFF) : _mm512_set1_epi8((char)0xFF);
+    for (; i + 64 <= size; i += 64) {
+        _mm512_storeu_si512(row + i, _mm512_xor_si512(_mm512_loadu_si512(row + i), wide_mask));
+    }
+#endif
+
+#ifdef __AVX2__
+    // 32 bytes hold a whole number of RGBA pixels, so the alpha mask never shifts
+    const __m256i mask = (channels == 4) ? _mm256_set1_epi32(0x00FFFFFF) : _mm256_set1_epi8((char)0xFF);
+    for (; i + 32 <= size; i += 32) {
+        const __m256i px = _mm256_loadu_si256((const __m256i *)(row + i));
+        _mm256_storeu_si256((__m256i *)(row + i), _mm256_xor_si256(px, mask));
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (channels != 4 || i % 4 != 3) row[i] = 255 - row[i];
+    }
+}
+
+static void brightness_row(unsigned char *row, int size, float brightness) {
+    int i = 0;
+
+#ifdef __AVX512BW__
+    for (; i + 64 <= size; i += 64) {
+        for (int k = 0; k < 64; k += 16) {
+            const __m512 v = _mm512_mul_ps(widen_bytes(row + i + k), _mm512_set1_ps(brightness));
+            narrow_bytes(row + i + k, _mm512_min_ps(v, _mm512_set1_ps(255.0f)));
+        }
+    }
+#endif
+
+#ifdef __AVX2__
+    const __m256 factor = _mm256_set1_ps(brightness);
+    const __m256 max = _mm256_set1_ps(255.0f);
+    for (; i + 32 <= size; i += 32) {
+        __m256 v[4];
+        unpack_bytes(_mm256_loadu_si256((const __m256i *)(row + i)), v);
+        for (int k = 0; k < 4; k++) {
+            v[k] = _mm256_min_ps(_mm256_mul_ps(v[k], factor), max);
+        }
+        _mm256_storeu_si256((__m256i *)(row + i), pack_bytes(v[0], v[1], v[2], v[3]));
+    }
+#endif
+
+    for (; i < size; i++) {
+        float new_val = row[i] * brightness;
+        row[i] = (new_val > 255.0f) ? 255 : (unsigned char)new_val;
+    }
+}
+
+static void contrast_row(unsigned char *row, int size, float factor) {
+    int i = 0;
+
+#ifdef __AVX512BW__
+    for (; i + 64 <= size; i += 64) {
+        for (int k = 0; k < 64; k += 16) {
+            const __m512 mid = _mm512_set1_ps(128.0f);
+            const __m512 v = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(factor), _mm512_sub_ps(widen_bytes(row + i + k), mid)), mid);
+            narrow_bytes(row + i + k, _mm512_min_ps(_mm512_max_ps(v, _mm512_setzero_ps()), _mm512_set1_ps(255.0f)));
+        }
+    }
+#endif
+
+#ifdef __AVX2__
+    const __m256 scale = _mm256_set1_ps(factor);
+    const __m256 mid = _mm256_set1_ps(128.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max = _mm256_set1_ps(255.0f);
+    for (; i + 32 <= size; i += 32) {
+        __m256 v[4];
+        unpack_bytes(_mm256_loadu_si256((const __m256i *)(row + i)), v);
+        for (int k = 0; k < 4; k++) {
+            const __m256 scaled = _mm256_add_ps(_mm256_mul_ps(scale, _mm256_sub_ps(v[k], mid)), mid);
+            v[k] = _mm256_min_ps(_mm256_max_ps(scaled, zero), max);
+        }
+        _mm256_storeu_si256((__m256i *)(row + i), pack_bytes(v[0], v[1], v[2], v[3]));
+    }
+#endif
+
+    for (; i < size; i++) {
+        int tmp_image = (int)row[i];
+        tmp_image = CLAMP(factor * (tmp_image - 128) + 128);
+        row[i] = (unsigned char)tmp_image;
+    }
+}
+
+/*
+ * Fixed-point brightness and contrast, 16 bits per lane. pmulhrsw computes
+ * (a * b + 2^14) >> 15; with a = v << 3 that is exactly FIXED_ROUND(v * b)
+ * for Q12 b, so the vector paths match brightness_fixed/contrast_fixed.
+ */
+static void brightness_fixed_row(unsigned char *row, int size, int factor) {
+    int i = 0;
+
+#ifdef __AVX512BW__
+    for (; i + 64 <= size; i += 64) {
+        const __m512i px = _mm512_loadu_si512(row + i);
+        const __m512i lo = _mm512_slli_epi16(_mm512_unpacklo_epi8(px, _mm512_setzero_si512()), 3);
+        const __m512i hi = _mm512_slli_epi16(_mm512_unpackhi_epi8(px, _mm512_setzero_si512()), 3);
+        const __m512i scale = _mm512_set1_epi16((short)factor);
+        _mm512_storeu_si512(row + i, _mm512_packus_epi16(_mm512_mulhrs_epi16(lo, scale), _mm512_mulhrs_epi16(hi, scale)));
+    }
+#endif
+
+#ifdef __AVX2__
+    const __m256i scale = _mm256_set1_epi16((short)factor);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= size; i += 32) {
+        const __m256i px = _mm256_loadu_si256((const __m256i *)(row + i));
+        // unpack and pack work per 128-bit lane in the same order, so bytes come back in place
+        const __m256i lo = _mm256_slli_epi16(_mm256_unpacklo_epi8(px, zero), 3);
+        const __m256i hi = _mm256_slli_epi16(_mm256_unpackhi_epi8(px, zero), 3);
+        _mm256_storeu_si256((__m256i *)(row + i), _mm256_packus_epi16(_mm256_mulhrs_epi16(lo, scale), _mm256_mulhrs_epi16(hi, scale)));
+    }
+#endif
+
+    for (; i < size; i++) {
+        row[i] = brightness_fixed(row[i], factor);
+    }
+}
+
+static void contrast_fixed_row(unsigned char *row, int size, int factor) {
+    int i = 0;
+
+#ifdef __AVX512BW__
+    for (; i + 64 <= size; i += 64) {
+        const __m512i px = _mm512_loadu_si512(row + i);
+        const __m512i mid = _mm512_set1_epi16(128);
+        const __m512i scale = _mm512_set1_epi16((short)factor);
+        const __m512i lo = _mm512_slli_epi16(_mm512_sub_epi16(_mm512_unpacklo_epi8(px, _mm512_setzero_si512()), mid), 3);
+        const __m512i hi = _mm512_slli_epi16(_mm512_sub_epi16(_mm512_unpackhi_epi8(px, _mm512_setzero_si512()), mid), 3);
+        _mm512_storeu_si512(row + i, _mm512_packus_epi16(_mm512_add_epi16(_mm512_mulhrs_epi16(lo, scale), mid),
+                                                         _mm512_add_epi16(_mm512_mulhrs_epi16(hi, scale), mid)));
+    }
+#endif
+
+#ifdef __AVX2__
+    const __m256i scale = _mm256_set1_epi16((short)factor);
+    const __m256i mid = _mm256_set1_epi16(128);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= size; i += 32) {
+        const __m256i px = _mm256_loadu_si256((const __m256i *)(row + i));
+        const __m256i lo = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_unpacklo_epi8(px, zero), mid), 3);
+        const __m256i hi = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_unpackhi_epi8(px, zero), mid), 3);
+        _mm256_storeu_si256((__m256i *)(row + i), _mm256_packus_epi16(_mm256_add_epi16(_mm256_mulhrs_epi16(lo, scale), mid),
+                                                                      _mm256_add_epi16(_mm256_mulhrs_epi16(hi, scale), mid)));
+    }
+#endif
+
+    for (; i < size; i++) {
+        row[i] = contrast_fixed(row[i], factor);
+    }
+}
+
+/**
+ * 256-entry byte lookup. The AVX2 path splits the table into sixteen
+ * 16-byte slices and selects one with pshufb per slice: subtracting 16*k
+ * and adding 0x70 with unsigned saturation leaves bit 7 clear only for
+ * bytes that fall into slice k, so every other lane of that shuffle is zero.
+ * AVX-512BW runs the same scheme on 64 bytes.
+ */
+static void lut_apply(unsigned char *data, int size, const unsigned char lut[256]) {
+    int i = 0;
+
+#ifdef __AVX512BW__
+    __m512i wide_tables[16];
+    for (int k = 0; k < 16; k++) {
+        wide_tables[k] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)(lut + 16 * k)));
+    }
+
+    for (; i + 64 <= size; i += 64) {
+        __m512i index = _mm512_loadu_si512(data + i);
+        __m512i result = _mm512_shuffle_epi8(wide_tables[0], _mm512_adds_epu8(index, _mm512_set1_epi8(0x70)));
+
+        for (int k = 1; k < 16; k++) {
+            index = _mm512_sub_epi8(index, _mm512_set1_epi8(16));
+            result = _mm512_or_si512(result, _mm512_shuffle_epi8(wide_tables[k], _mm512_adds_epu8(index, _mm512_set1_epi8(0x70))));
+        }
+
+        _mm512_storeu_si512(data + i, result);
+    }
+#endif
+
+#ifdef __AVX2__
+    __m256i tables[16];
+    for (int k = 0; k < 16; k++) {
+        tables[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lut + 16 * k)));
+    }
+
+    const __m256i slice = _mm256_set1_epi8(16);
+    const __m256i bias = _mm256_set1_epi8(0x70);
+
+    for (; i + 32 <= size; i += 32) {
+        __m256i index = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i result = _mm256_shuffle_epi8(tables[0], _mm256_adds_epu8(index, bias));
+
+        for (int k = 1; k < 16; k++) {
+            index = _mm256_sub_epi8(index, slice);
+            result = _mm256_or_si256(result, _mm256_shuffle_epi8(tables[k], _mm256_adds_epu8(index, bias)));
+        }
+
+        _mm256_storeu_si256((__m256i *)(data + i), result);
+    }
+#endif
+
+    for (; i < size; i++) {
+        data[i] = lut[data[i]];
+    }
+}
+
+#ifdef __AVX2__
+// 16 RGB pixels per step, in 128-bit registers: three pshufb gathers per plane from the three 16-byte loads.
+static int deinterleave_rgb_128(const unsigned char *src, unsigned char *r, unsigned char *g, unsigned char *b,
+                                int width) {
+    const __m128i r0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i b0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+        const __m128i m = _mm_loadu_si128((const __m128i *)(src + 3 * x + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i *)(src + 3 * x + 32));
+
+        _mm_storeu_si128((__m128i *)(r + x), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, r0),
+            _mm_shuffle_epi8(m, r1)), _mm_shuffle_epi8(c, r2)));
+        _mm_storeu_si128((__m128i *)(g + x), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, g0),
+            _mm_shuffle_epi8(m, g1)), _mm_shuffle_epi8(c, g2)));
+        _mm_storeu_si128((__m128i *)(b + x), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, b0),
+            _mm_shuffle_epi8(m, b1)), _mm_shuffle_epi8(c, b2)));
+    }
+
+    return x;
+}
+
+static int interleave_rgb_128(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                              unsigned char *dst, int width) {
+    const __m128i o0r = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i o0g = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i o0b = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i o1r = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i o1g = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i o1b = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i o2r = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i o2g = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i o2b = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i vr = _mm_loadu_si128((const __m128i *)(r + x));
+        const __m128i vg = _mm_loadu_si128((const __m128i *)(g + x));
+        const __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+
+        _mm_storeu_si128((__m128i *)(dst + 3 * x), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, o0r),
+            _mm_shuffle_epi8(vg, o0g)), _mm_shuffle_epi8(vb, o0b)));
+        _mm_storeu_si128((__m128i *)(dst + 3 * x + 16), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, o1r),
+            _mm_shuffle_epi8(vg, o1g)), _mm_shuffle_epi8(vb, o1b)));
+        _mm_storeu_si128((__m128i *)(dst + 3 * x + 32), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, o2r),
+            _mm_shuffle_epi8(vg, o2g)), _mm_shuffle_epi8(vb, o2b)));
+    }
+
+    return x;
+}
+
+// 16 RGBA pixels per step: group channels inside each load, then a 4x4 transpose of 32-bit lanes.
+static int deinterleave_rgba_128(const unsigned char *src, unsigned char *planes[4], int width) {
+    const __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * x)), group);
+        const __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * x + 16)), group);
+        const __m128i v2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * x + 32)), group);
+        const __m128i v3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 4 * x + 48)), group);
+
+        const __m128i rg01 = _mm_unpacklo_epi32(v0, v1);
+        const __m128i ba01 = _mm_unpackhi_epi32(v0, v1);
+        const __m128i rg23 = _mm_unpacklo_epi32(v2, v3);
+        const __m128i ba23 = _mm_unpackhi_epi32(v2, v3);
+
+        _mm_storeu_si128((__m128i *)(planes[0] + x), _mm_unpacklo_epi64(rg01, rg23));
+        _mm_storeu_si128((__m128i *)(planes[1] + x), _mm_unpackhi_epi64(rg01, rg23));
+        _mm_storeu_si128((__m128i *)(planes[2] + x), _mm_unpacklo_epi64(ba01, ba23));
+        _mm_storeu_si128((__m128i *)(planes[3] + x), _mm_unpackhi_epi64(ba01, ba23));
+    }
+
+    return x;
+}
+
+static int interleave_rgba_128(unsigned char *const planes[4], unsigned char *dst, int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i r = _mm_loadu_si128((const __m128i *)(planes[0] + x));
+        const __m128i g = _mm_loadu_si128((const __m128i *)(planes[1] + x));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(planes[2] + x));
+        const __m128i a = _mm_loadu_si128((const __m128i *)(planes[3] + x));
+
+        const __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+        const __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+        const __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+        const __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+
+        _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+
+    return x;
+}
+#endif
+
+static void deinterleave_row(const unsigned char *src, unsigned char *planes[4], int width, int channels) {
+    int x = 0;
+
+#ifdef __AVX2__
+    if (channels == 3) {
+        x = deinterleave_rgb_128(src, planes[0], planes[1], planes[2], width);
+    } else if (channels == 4) {
+        x = deinterleave_rgba_128(src, planes, width);
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+            planes[c][x] = src[x * channels + c];
+        }
+    }
+}
+
+static void interleave_row(unsigned char *const planes[4], unsigned char *dst, int width, int channels) {
+    int x = 0;
+
+#ifdef __AVX2__
+    if (channels == 3) {
+        x = interleave_rgb_128(planes[0], planes[1], planes[2], dst, width);
+    } else if (channels == 4) {
+        x = interleave_rgba_128(planes, dst, width);
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (int c = 0; c < channels; c++) {
+            dst[x * channels + c] = planes[c][x];
+        }
+    }
+}
+
+/*
+ * Premultiplied alpha. The RGBA neighbourhood filters blur or
+ * differentiate colour weighted by alpha, so a transparent pixel's colour
+ * does not bleed into its neighbours. premultiply and unpremultiply in
+ * image_utils.h are the scalar definitions.
+ */
+#ifdef __AVX2__
+static const unsigned char alpha_mask[32] = {
+    0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF,
+    0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF
+};
+
+// round(v * a / 255) of 16-bit lanes; a * v + 128 + its high byte fits 16 bits.
+static inline __m256i premultiply_words(__m256i v, __m256i a) {
+    const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Eight RGBA pixels; shufflelo/hi with 0xFF spreads each pixel's alpha word over the pixel.
+static inline __m256i premultiply_px8(__m256i px) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_unpacklo_epi8(px, zero);
+    const __m256i hi = _mm256_unpackhi_epi8(px, zero);
+    const __m256i a_lo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xFF), 0xFF);
+    const __m256i a_hi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xFF), 0xFF);
+    const __m256i out = _mm256_packus_epi16(premultiply_words(lo, a_lo), premultiply_words(hi, a_hi));
+    return _mm256_blendv_epi8(out, px, _mm256_loadu_si256((const __m256i *)alpha_mask));
+}
+
+// (v * 255) / a + 0.5 for two pixels of 32-bit lanes; a = 0 gives 0.
+static inline __m256i unpremultiply_lanes(__m256i px) {
+    const __m256 v = _mm256_cvtepi32_ps(px);
+    const __m256 a = _mm256_permute_ps(v, 0xFF);
+    const __m256 straight = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), a),
+                                          _mm256_set1_ps(0.5f));
+    return _mm256_cvttps_epi32(_mm256_and_ps(straight, _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_OQ)));
+}
+
+// Four premultiplied RGBA pixels; the alpha bytes come out as 255 or 0, callers put theirs back.
+static inline __m128i unpremultiply_px4(__m128i px) {
+    const __m256i lo = unpremultiply_lanes(_mm256_cvtepu8_epi32(px));
+    const __m256i hi = unpremultiply_lanes(_mm256_cvtepu8_epi32(_mm_srli_si128(px, 8)));
+    return _mm_packus_epi16(_mm_packs_epi32(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1)),
+                            _mm_packs_epi32(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1)));
+}
+
+// premultiply_words for the 16-bit lanes r g b a of one pixel; alpha comes out wrong.
+static inline __m128i premultiply_px1(__m128i px) {
+    const __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, _mm_shufflelo_epi16(px, 0xFF)), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// unpremultiply_px4 for the low pixel only.
+static inline __m128i unpremultiply_px1(__m128i px) {
+    const __m128 v = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(px));
+    const __m128 a = _mm_shuffle_ps(v, v, 0xFF);
+    const __m128 straight = _mm_add_ps(_mm_div_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), a), _mm_set1_ps(0.5f));
+    const __m128i i = _mm_cvttps_epi32(_mm_and_ps(straight, _mm_cmpneq_ps(a, _mm_setzero_ps())));
+    const __m128i words = _mm_packs_epi32(i, i);
+    return _mm_packus_epi16(words, words);
+}
+#endif
+
+// RGBA row from src into dst (which may be src) with colour multiplied by alpha.
+static void premultiply_row(const unsigned char *src, unsigned char *dst, int width) {
+    int x = 0;
+
+#ifdef __AVX2__
+    for (; x + 8 <= width; x += 8) {
+        const __m256i px = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+        _mm256_storeu_si256((__m256i *)(dst + x * 4), premultiply_px8(px));
+    }
+#endif
+
+    for (; x < width; x++) {
+        const unsigned char *p = src + x * 4;
+        unsigned char *q = dst + x * 4;
+        const int a = p[3];
+        q[0] = premultiply(p[0], a);
+        q[1] = premultiply(p[1], a);
+        q[2] = premultiply(p[2], a);
+        q[3] = (unsigned char)a;
+    }
+}
+
+/*
+ * Premultiplied RGBA row src into dst, which holds the original pixels:
+ * colour is divided by src's alpha and dst keeps its own alpha.
+ */
+static void unpremultiply_pixels(const unsigned char *src, unsigned char *dst, int width) {
+    int x = 0;
+
+#ifdef __AVX2__
+    const __m128i alpha = _mm_loadu_si128((const __m128i *)alpha_mask);
+
+    for (; x + 4 <= width; x += 4) {
+        const __m128i px = unpremultiply_px4(_mm_loadu_si128((const __m128i *)(src + x * 4)));
+        const __m128i keep = _mm_loadu_si128((const __m128i *)(dst + x * 4));
+        _mm_storeu_si128((__m128i *)(dst + x * 4), _mm_blendv_epi8(px, keep, alpha));
+    }
+#endif
+
+    for (; x < width; x++) {
+        const unsigned char *p = src + x * 4;
+        unsigned char *q = dst + x * 4;
+        q[0] = unpremultiply(p[0], p[3]);
+        q[1] = unpremultiply(p[1], p[3]);
+        q[2] = unpremultiply(p[2], p[3]);
+    }
+}
+
+// Colour planes of one planar RGBA row multiplied by planes[3] in place.
+static void premultiply_planar_row(unsigned char *const planes[4], int width) {
+    const unsigned char *a = planes[3];
+    int x = 0;
+
+#ifdef __AVX2__
+    for (; x + 16 <= width; x += 16) {
+        const __m256i alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(a + x)));
+        for (int c = 0; c < 3; c++) {
+            const __m256i v = premultiply_words(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(planes[c] + x))),
+                                                alpha);
+            _mm_storeu_si128((__m128i *)(planes[c] + x),
+                             _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (int c = 0; c < 3; c++) {
+            planes[c][x] = premultiply(planes[c][x], a[x]);
+        }
+    }
+}
+
+// Colour planes divided by planes[3] in place; planes[3] is only read.
+static void unpremultiply_planar_row(unsigned char *const planes[4], int width) {
+    const unsigned char *a = planes[3];
+    int x = 0;
+
+#ifdef __AVX2__
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    for (; x + 8 <= width; x += 8) {
+        const __m256 alpha = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(a + x))));
+        const __m256 nonzero = _mm256_cmp_ps(alpha, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+        for (int c = 0; c < 3; c++) {
+            const __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(planes[c] + x))));
+            const __m256 straight = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(v, scale), alpha), half);
+            const __m256i i = _mm256_cvttps_epi32(_mm256_and_ps(straight, nonzero));
+            const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1));
+            _mm_storel_epi64((__m128i *)(planes[c] + x), _mm_packus_epi16(words, words));
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (int c = 0; c < 3; c++) {
+            planes[c][x] = unpremultiply(planes[c][x], a[x]);
+        }
+    }
+}
+
+/*
+ * Box filter with integer sums. A box of d = 2 * radius + 1 bytes sums to
+ * at most 255 * d, so sums fit 16-bit lanes, and floor(sum / d) is
+ * (sum * mul) >> (16 + shift) with shift = floor(log2 d). That is exact for
+ * radius <= 100 and equals the old float (unsigned char)(sum * (1.0f / d))
+ * for every radius gaussian_blur uses, so the output bytes are unchanged.
+ * Radius 0 is a copy; mul would need 17 bits. Every byte is blurred, alpha
+ * included: RGBA rows arrive premultiplied.
+ */
+static inline void box_divisor(int radius, unsigned *mul, int *shift) {
+    const unsigned d = 2 * radius + 1;
+    *shift = 31 - __builtin_clz(d);
+    *mul = ((1u << (16 + *shift)) + d - 1) / d;
+}
+
+static inline unsigned char box_div(unsigned sum, unsigned mul, int shift) {
+    return (unsigned char)(((sum * mul) >> 16) >> shift);
+}
+
+// Pixels [x0, x1) of one row, a running sum per channel, edges clamped.
+static void box_h_pixels(const unsigned char *src, unsigned char *dst, int width, int channels, int radius,
+                         unsigned mul, int shift, int x0, int x1) {
+    for (int c = 0; c < channels; c++) {
+        unsigned sum = 0;
+        for (int j = x0 - radius; j <= x0 + radius; j++) {
+            const int p = (j < 0) ? 0 : (j >= width) ? width - 1 : j;
+            sum += src[p * channels + c];
+        }
+
+        for (int x = x0; x < x1; x++) {
+            dst[x * channels + c] = box_div(sum, mul, shift);
+
+            const int add = (x + radius + 1 < width) ? x + radius + 1 : width - 1;
+            const int sub = (x - radius > 0) ? x - radius : 0;
+            sum += src[add * channels + c] - src[sub * channels + c];
+        }
+    }
+}
+
+#ifdef __AVX2__
+static inline __m256i box_load(const unsigned char *p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+}
+
+static inline __m128i box_pack(__m256i sum, __m256i mul, __m128i shift) {
+    const __m256i q = _mm256_srl_epi16(_mm256_mulhi_epu16(sum, mul), shift);
+    return _mm_packus_epi16(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+}
+
+/*
+ * Sixteen bytes of the row per vector. Shifting the window by one pixel
+ * moves every lane by channels bytes, so a lane's neighbours are plain
+ * unaligned loads and 3 and 4 channels need no per-channel code. A step of
+ * whole pixels (15 bytes for RGB) updates all sixteen sums at once.
+ */
+static int box_h_row_avx2(const unsigned char *src, unsigned char *dst, int width, int channels, int radius,
+                          unsigned mul, int shift) {
+    const int size = width * channels;
+    const int reach = radius * channels;
+    const int pixels = 16 / channels;
+    const int step = pixels * channels;
+    const __m256i mul_v = _mm256_set1_epi16((short)mul);
+    const __m128i shift_v = _mm_cvtsi32_si128(shift);
+
+    int o = reach;
+    if (o + 16 + reach > size) {
+        return 0;
+    }
+
+    __m256i sum = _mm256_setzero_si256();
+    for (int j = -reach; j <= reach; j += channels) {
+        sum = _mm256_add_epi16(sum, box_load(src + o + j));
+    }
+
+    for (;;) {
+        _mm_storeu_si128((__m128i *)(dst + o), box_pack(sum, mul_v, shift_v));
+
+        if (o + step + 16 + reach > size) {
+            break;
+        }
+
+        for (int t = 0; t < pixels; t++) {
+            const __m256i add = box_load(src + o + reach + (t + 1) * channels);
+            const __m256i sub = box_load(src + o - reach + t * channels);
+            sum = _mm256_add_epi16(sum, _mm256_sub_epi16(add, sub));
+        }
+        o += step;
+    }
+
+    // pixels before the last vector's partial one are done
+    return (o + step) / channels;
+}
+#endif
+
+static void box_h_row(const unsigned char *src, unsigned char *dst, int width, int channels, int radius) {
+    if (radius == 0) {
+        memcpy(dst, src, (size_t)width * channels);
+        return;
+    }
+
+    unsigned mul;
+    int shift;
+    box_divisor(radius, &mul, &shift);
+
+    int x = 0;
+
+#ifdef __AVX2__
+    if (channels <= 4) {
+        x = box_h_row_avx2(src, dst, width, channels, radius, mul, shift);
+        if (x > 0) {
+            // the vectors start at pixel radius; the left edge is still to do
+            box_h_pixels(src, dst, width, channels, radius, mul, shift, 0, radius);
+        }
+    }
+#endif
+
+    box_h_pixels(src, dst, width, channels, radius, mul, shift, x, width);
+}
+
+/*
+ * One output row of the vertical box pass: acc holds a running sum per
+ * byte column and add and sub are the rows entering and leaving the window
+ * (with radius 0 add is the centre row). When unpremultiply is set the
+ * bytes are premultiplied RGBA pixels and out holds the original ones: the
+ * blurred colour is divided by the blurred alpha and out keeps its alpha.
+ */
+static void box_v_row(unsigned short *acc, const unsigned char *add, const unsigned char *sub,
+                      unsigned char *out, int size, int radius, int unpremultiply_out) {
+    if (radius == 0) {
+        if (unpremultiply_out) {
+            unpremultiply_pixels(add, out, size / 4);
+        } else {
+            memcpy(out, add, size);
+        }
+        return;
+    }
+
+    unsigned mul;
+    int shift;
+    box_divisor(radius, &mul, &shift);
+
+    int x = 0;
+
+#ifdef __AVX2__
+    const __m256i mul_v = _mm256_set1_epi16((short)mul);
+    const __m128i shift_v = _mm_cvtsi32_si128(shift);
+    const __m128i alpha = _mm_loadu_si128((const __m128i *)alpha_mask);
+
+    for (; x + 16 <= size; x += 16) {
+        __m256i sum = _mm256_loadu_si256((const __m256i *)(acc + x));
+        sum = _mm256_add_epi16(sum, _mm256_sub_epi16(box_load(add + x), box_load(sub + x)));
+        _mm256_storeu_si256((__m256i *)(acc + x), sum);
+
+        __m128i px = box_pack(sum, mul_v, shift_v);
+        if (unpremultiply_out) {
+            px = _mm_blendv_epi8(unpremultiply_px4(px), _mm_loadu_si128((const __m128i *)(out + x)), alpha);
+        }
+        _mm_storeu_si128((__m128i *)(out + x), px);
+    }
+#endif
+
+    if (unpremultiply_out) {
+        for (; x < size; x += 4) {
+            unsigned char px[4];
+            for (int c = 0; c < 4; c++) {
+                acc[x + c] += add[x + c] - sub[x + c];
+                px[c] = box_div(acc[x + c], mul, shift);
+            }
+            for (int c = 0; c < 3; c++) {
+                out[x + c] = unpremultiply(px[c], px[3]);
+            }
+        }
+        return;
+    }
+
+    for (; x < size; x++) {
+        acc[x] += add[x] - sub[x];
+        out[x] = box_div(acc[x], mul, shift);
+    }
+}
+
+/*
+ * Recursive Gaussian rows, coef = {B, b1, b2, b3} normalised by b0: one
+ * step of the third-order recursion for n byte columns at once. Doubles,
+ * because with large sigma the poles sit close to 1 and float rounding is
+ * amplified into visible banding. The newest value is added last, which
+ * keeps the row-to-row dependency short; the vector and scalar paths add
+ * in the same order, so every variant gives the same bytes. With
+ * premultiply_src the bytes are RGBA pixels and are premultiplied as read.
+ */
+static void iir_forward_row(const unsigned char *src, double *w, const double *w1, const double *w2,
+                            const double *w3, int n, int premultiply_src, const double coef[4]) {
+    int x = 0;
+
+#ifdef __AVX2__
+    const __m256d b = _mm256_set1_pd(coef[0]);
+    const __m256d c1 = _mm256_set1_pd(coef[1]);
+    const __m256d c2 = _mm256_set1_pd(coef[2]);
+    const __m256d c3 = _mm256_set1_pd(coef[3]);
+
+    for (; x + 4 <= n; x += 4) {
+        int bytes;
+        memcpy(&bytes, src + x, sizeof(bytes));
+        __m128i px = _mm_cvtepu8_epi16(_mm_cvtsi32_si128(bytes));
+        if (premultiply_src) {
+            // one pixel per step, so the words are r g b a
+            px = _mm_blend_epi16(premultiply_px1(px), px, 0x08);
+        }
+        const __m256d in = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(px));
+
+        __m256d t = _mm256_mul_pd(b, in);
+        t = _mm256_add_pd(t, _mm256_mul_pd(c3, _mm256_loadu_pd(w3 + x)));
+        t = _mm256_add_pd(t, _mm256_mul_pd(c2, _mm256_loadu_pd(w2 + x)));
+        t = _mm256_add_pd(t, _mm256_mul_pd(c1, _mm256_loadu_pd(w1 + x)));
+        _mm256_storeu_pd(w + x, t);
+    }
+#endif
+
+    for (; x < n; x++) {
+        const int v = (premultiply_src && x % 4 != 3) ? premultiply(src[x], src[x | 3]) : src[x];
+        double t = coef[0] * v;
+        t += coef[3] * w3[x];
+        t += coef[2] * w2[x];
+        t += coef[1] * w1[x];
+        w[x] = t;
+    }
+}
+
+static inline unsigned char iir_round(double t) {
+    const double v = t + 0.5;
+    return (v <= 0.0) ? 0 : (v >= 255.0) ? 255 : (unsigned char)v;
+}
+
+/*
+ * Backward step: w becomes the filtered row and is rounded into out. With
+ * unpremultiply_out the rounded pixels are divided by their alpha and out
+ * keeps its own alpha, as in box_v_row.
+ */
+static void iir_backward_row(double *w, const double *y1, const double *y2, const double *y3,
+                             unsigned char *out, int n, int unpremultiply_out, const double coef[4]) {
+    int x = 0;
+
+#ifdef __AVX2__
+    const __m256d b = _mm256_set1_pd(coef[0]);
+    const __m256d c1 = _mm256_set1_pd(coef[1]);
+    const __m256d c2 = _mm256_set1_pd(coef[2]);
+    const __m256d c3 = _mm256_set1_pd(coef[3]);
+    const __m256d half = _mm256_set1_pd(0.5);
+
+    for (; x + 4 <= n; x += 4) {
+        __m256d t = _mm256_mul_pd(b, _mm256_loadu_pd(w + x));
+        t = _mm256_add_pd(t, _mm256_mul_pd(c3, _mm256_loadu_pd(y3 + x)));
+        t = _mm256_add_pd(t, _mm256_mul_pd(c2, _mm256_loadu_pd(y2 + x)));
+        t = _mm256_add_pd(t, _mm256_mul_pd(c1, _mm256_loadu_pd(y1 + x)));
+        _mm256_storeu_pd(w + x, t);
+
+        const __m128i v = _mm256_cvttpd_epi32(_mm256_add_pd(t, half));
+        const __m128i words = _mm_packs_epi32(v, v);
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        if (unpremultiply_out) {
+            int keep;
+            memcpy(&keep, out + x, sizeof(keep));
+            bytes = _mm_cvtsi128_si32(unpremultiply_px1(_mm_cvtsi32_si128(bytes)));
+            bytes = (bytes & 0x00FFFFFF) | (keep & (int)0xFF000000);
+        }
+        memcpy(out + x, &bytes, sizeof(bytes));
+    }
+#endif
+
+    const int tail = x;
+    for (; x < n; x++) {
+        double t = coef[0] * w[x];
+        t += coef[3] * y3[x];
+        t += coef[2] * y2[x];
+        t += coef[1] * y1[x];
+        w[x] = t;
+
+        if (!unpremultiply_out) out[x] = iir_round(t);
+    }
+
+    if (unpremultiply_out) {
+        for (x = tail; x < n; x += 4) {
+            const unsigned char a = iir_round(w[x + 3]);
+            for (int c = 0; c < 3; c++) {
+                out[x + c] = unpremultiply(iir_round(w[x + c]), a);
+            }
+        }
+    }
+}
+
+/*
+ * Luma for edge detection: ((0.299 r + 0.587 g) + 0.114 b) in float,
+ * truncated, the same expression and order as the scalar loop. RGBA
+ * colour is premultiplied first. Images with fewer than three channels
+ * use their first channel.
+ */
+static void gray_planar_row(unsigned char *const planes[4], unsigned char *gray, int width, int channels) {
+    if (channels < 3) {
+        memcpy(gray, planes[0], width);
+        return;
+    }
+
+    int x = 0;
+
+#ifdef __AVX2__
+    const __m256 wr = _mm256_set1_ps(GRAY_R_WEIGHT);
+    const __m256 wg = _mm256_set1_ps(GRAY_G_WEIGHT);
+    const __m256 wb = _mm256_set1_ps(GRAY_B_WEIGHT);
+
+    for (; x + 16 <= width; x += 16) {
+        __m256i c[3];
+        for (int k = 0; k < 3; k++) {
+            c[k] = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(planes[k] + x)));
+        }
+        if (channels == 4) {
+            const __m256i alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(planes[3] + x)));
+            for (int k = 0; k < 3; k++) c[k] = premultiply_words(c[k], alpha);
+        }
+
+        __m256i half[2];
+        for (int h = 0; h < 2; h++) {
+            __m256 v[3];
+            for (int k = 0; k < 3; k++) {
+                const __m128i words = h ? _mm256_extracti128_si256(c[k], 1) : _mm256_castsi256_si128(c[k]);
+                v[k] = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(words));
+            }
+            const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wr, v[0]), _mm256_mul_ps(wg, v[1])),
+                                             _mm256_mul_ps(wb, v[2]));
+            half[h] = _mm256_cvttps_epi32(sum);
+        }
+        const __m128i lo = _mm_packs_epi32(_mm256_castsi256_si128(half[0]), _mm256_extracti128_si256(half[0], 1));
+        const __m128i hi = _mm_packs_epi32(_mm256_castsi256_si128(half[1]), _mm256_extracti128_si256(half[1], 1));
+        _mm_storeu_si128((__m128i *)(gray + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; x < width; x++) {
+        int r = planes[0][x], g = planes[1][x], b = planes[2][x];
+        if (channels == 4) {
+            const int a = planes[3][x];
+            r = premultiply(r, a);
+            g = premultiply(g, a);
+            b = premultiply(b, a);
+        }
+        gray[x] = (unsigned char)(GRAY_R_WEIGHT * r + GRAY_G_WEIGHT * g + GRAY_B_WEIGHT * b);
+    }
+}
+
+// Interleaved rows go through deinterleave_row in chunks that stay in L1.
+static void gray_row(const unsigned char *src, unsigned char *gray, int width, int channels) {
+    if (channels < 3) {
+        for (int x = 0; x < width; x++) gray[x] = src[x * channels];
+        return;
+    }
+
+    unsigned char chunk[4][GRAY_CHUNK];
+    unsigned char *planes[4] = {chunk[0], chunk[1], chunk[2], chunk[3]};
+
+    for (int x = 0; x < width; x += GRAY_CHUNK) {
+        const int n = (width - x < GRAY_CHUNK) ? width - x : GRAY_CHUNK;
+        deinterleave_row(src + (size_t)x * channels, planes, n, channels);
+        gray_planar_row(planes, gray + x, n, channels);
+    }
+}
+
+#ifdef __AVX2__
+// 16 mask bytes into every channel but alpha of 16 pixels; channels is 1, 3 or 4.
+static inline void store_mask(__m128i mask, unsigned char *out, int channels) {
+    if (channels == 1) {
+        _mm_storeu_si128((__m128i *)out, mask);
+    } else if (channels == 3) {
+        const __m128i expand[3] = {
+            _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5),
+            _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10),
+            _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15)
+        };
+        for (int k = 0; k < 3; k++) {
+            _mm_storeu_si128((__m128i *)(out + 16 * k), _mm_shuffle_epi8(mask, expand[k]));
+        }
+    } else {
+        const __m128i expand[4] = {
+            _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+            _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+            _mm_setr_epi8(8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11),
+            _mm_setr_epi8(12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15)
+        };
+        const __m128i alpha = _mm_loadu_si128((const __m128i *)alpha_mask);
+        for (int k = 0; k < 4; k++) {
+            unsigned char *dst = out + 16 * k;
+            const __m128i px = _mm_shuffle_epi8(mask, expand[k]);
+            _mm_storeu_si128((__m128i *)dst, _mm_blendv_epi8(px, _mm_loadu_si128((const __m128i *)dst), alpha));
+        }
+    }
+}
+
+// Sobel gx and gy of 16 pixels from x - 1 .. x + 16, in 16-bit lanes.
+static inline void sobel16(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                           int x, __m256i *gx, __m256i *gy) {
+    const __m256i a_l = box_load(above + x - 1), a_c = box_load(above + x), a_r = box_load(above + x + 1);
+    const __m256i b_l = box_load(below + x - 1), b_c = box_load(below + x), b_r = box_load(below + x + 1);
+    const __m256i r_l = box_load(row + x - 1), r_r = box_load(row + x + 1);
+
+    const __m256i s_l = _mm256_add_epi16(_mm256_add_epi16(a_l, b_l), _mm256_add_epi16(r_l, r_l));
+    const __m256i s_r = _mm256_add_epi16(_mm256_add_epi16(a_r, b_r), _mm256_add_epi16(r_r, r_r));
+    const __m256i d_c = _mm256_sub_epi16(a_c, b_c);
+    *gx = _mm256_sub_epi16(s_r, s_l);
+    *gy = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(a_l, b_l), _mm256_sub_epi16(a_r, b_r)),
+                           _mm256_add_epi16(d_c, d_c));
+}
+#endif
+
+/*
+ * One row of the Sobel edge mask from three gray rows, written as 255 or
+ * 0 into every channel of out but alpha. Both kernels are separable: a
+ * vertical [1 2 1] smoothing and [1 0 -1] difference, then the horizontal
+ * difference and smoothing, so a pixel costs a few adds instead of nine
+ * multiply-adds. A pixel is an edge when gx^2 + gy^2 > limit. The first
+ * and last column, and the whole row when above or below is NULL, are 0.
+ */
+static void edge_row(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                     unsigned char *out, int width, int channels, int limit) {
+    const int colour = (channels == 4) ? 3 : channels;
+    int x = 1;
+
+    if (!above || !below || width < 3) {
+        for (int p = 0; p < width; p++) {
+            for (int c = 0; c < colour; c++) out[p * channels + c] = 0;
+        }
+        return;
+    }
+
+#ifdef __AVX2__
+    const __m256i limit_v = _mm256_set1_epi32(limit);
+
+    if (channels == 1 || channels == 3 || channels == 4) {
+        for (; x + 17 <= width; x += 16) {
+            __m256i gx, gy;
+            sobel16(above, row, below, x, &gx, &gy);
+
+            // (gx, gy) pairs through madd give gx^2 + gy^2 in 32 bits; packs restores the lane order
+            const __m256i lo = _mm256_unpacklo_epi16(gx, gy);
+            const __m256i hi = _mm256_unpackhi_epi16(gx, gy);
+            const __m256i edge = _mm256_packs_epi32(_mm256_cmpgt_epi32(_mm256_madd_epi16(lo, lo), limit_v),
+                                                    _mm256_cmpgt_epi32(_mm256_madd_epi16(hi, hi), limit_v));
+            const __m128i mask = _mm_packs_epi16(_mm256_castsi256_si128(edge), _mm256_extracti128_si256(edge, 1));
+
+            store_mask(mask, out + x * channels, channels);
+        }
+    }
+#endif
+
+    for (; x < width - 1; x++) {
+        const int gx = (above[x + 1] - above[x - 1]) + 2 * (row[x + 1] - row[x - 1]) + (below[x + 1] - below[x - 1]);
+        const int gy = (above[x - 1] + 2 * above[x] + above[x + 1]) - (below[x - 1] + 2 * below[x] + below[x + 1]);
+        const unsigned char edge = (gx * gx + gy * gy > limit) ? 255 : 0;
+        for (int c = 0; c < colour; c++) out[x * channels + c] = edge;
+    }
+
+    for (int c = 0; c < colour; c++) {
+        out[c] = 0;
+        out[(width - 1) * channels + c] = 0;
+    }
+}
+
+/*
+ * Sobel gradient of one blurred gray row for the Canny detector: mag is
+ * gx^2 + gy^2 and dir the neighbour pair non-max suppression compares,
+ * 0 left/right, 1 above/below, 2 above-right/below-left, 3 above-left/
+ * below-right. The sector edges are tan(22.5) in Q16 on |g| << 5, the
+ * same integer compares in every variant. The first and last pixel get 0.
+ */
+static void canny_gradient_row(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                               int *mag, unsigned char *dir, int width) {
+    int x = 1;
+
+#ifdef __AVX2__
+    const __m256i tan_q16 = _mm256_set1_epi16((short)CANNY_TAN_Q16);
+    const __m256i two = _mm256_set1_epi16(2), one = _mm256_set1_epi16(1);
+
+    for (; x + 17 <= width; x += 16) {
+        __m256i gx, gy;
+        sobel16(above, row, below, x, &gx, &gy);
+
+        const __m256i lo = _mm256_unpacklo_epi16(gx, gy);
+        const __m256i hi = _mm256_unpackhi_epi16(gx, gy);
+        const __m256i m_lo = _mm256_madd_epi16(lo, lo), m_hi = _mm256_madd_epi16(hi, hi);
+        _mm256_storeu_si256((__m256i *)(mag + x), _mm256_permute2x128_si256(m_lo, m_hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(mag + x + 8), _mm256_permute2x128_si256(m_lo, m_hi, 0x31));
+
+        const __m256i sx = _mm256_slli_epi16(_mm256_abs_epi16(gx), 5);
+        const __m256i sy = _mm256_slli_epi16(_mm256_abs_epi16(gy), 5);
+        const __m256i horizontal = _mm256_cmpgt_epi16(_mm256_mulhi_epu16(sx, tan_q16), sy);
+        const __m256i vertical = _mm256_cmpgt_epi16(_mm256_mulhi_epu16(sy, tan_q16), sx);
+        // 2 when gx and gy share a sign, 3 when they differ
+        __m256i d = _mm256_sub_epi16(two, _mm256_srai_epi16(_mm256_xor_si256(gx, gy), 15));
+        d = _mm256_blendv_epi8(d, one, vertical);
+        d = _mm256_andnot_si256(horizontal, d);
+        _mm_storeu_si128((__m128i *)(dir + x),
+                         _mm_packus_epi16(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1)));
+    }
+#endif
+
+    for (; x < width - 1; x++) {
+        const int gx = (above[x + 1] - above[x - 1]) + 2 * (row[x + 1] - row[x - 1]) + (below[x + 1] - below[x - 1]);
+        const int gy = (above[x - 1] + 2 * above[x] + above[x + 1]) - (below[x - 1] + 2 * below[x] + below[x + 1]);
+        const unsigned sx = (unsigned)abs(gx) << 5, sy = (unsigned)abs(gy) << 5;
+        mag[x] = gx * gx + gy * gy;
+        if (((sx * CANNY_TAN_Q16) >> 16) > sy) {
+            dir[x] = 0;
+        } else if (((sy * CANNY_TAN_Q16) >> 16) > sx) {
+            dir[x] = 1;
+        } else {
+            dir[x] = ((gx ^ gy) < 0) ? 3 : 2;
+        }
+    }
+
+    mag[0] = 0;
+    dir[0] = 0;
+    if (width > 1) {
+        mag[width - 1] = 0;
+        dir[width - 1] = 0;
+    }
+}
+
+/*
+ * Non-max suppression of one row of canny_gradient_row output: 2 where
+ * mag is a maximum across the edge and above high, 1 where it is only
+ * above low, 0 elsewhere and in the first and last pixel. A pixel must
+ * beat one neighbour and at least tie the other, so a ridge two pixels
+ * wide keeps one of them.
+ */
+static void canny_nms_row(const int *above, const int *row, const int *below, const unsigned char *dir,
+                          unsigned char *map, int width, int low, int high) {
+    int x = 1;
+
+#ifdef __AVX2__
+    const __m256i low_v = _mm256_set1_epi32(low), high_v = _mm256_set1_epi32(high);
+    const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+
+    for (; x + 9 <= width; x += 8) {
+        const __m256i d = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(dir + x)));
+        const __m256i left = _mm256_cmpeq_epi32(d, _mm256_setzero_si256());
+        const __m256i up = _mm256_cmpeq_epi32(d, one);
+        const __m256i rising = _mm256_cmpeq_epi32(d, two);
+
+        const __m256i m = _mm256_loadu_si256((const __m256i *)(row + x));
+        const __m256i a_l = _mm256_loadu_si256((const __m256i *)(above + x - 1));
+        const __m256i a_r = _mm256_loadu_si256((const __m256i *)(above + x + 1));
+        const __m256i b_l = _mm256_loadu_si256((const __m256i *)(below + x - 1));
+        const __m256i b_r = _mm256_loadu_si256((const __m256i *)(below + x + 1));
+
+        __m256i n1 = _mm256_blendv_epi8(a_l, a_r, rising);
+        __m256i n2 = _mm256_blendv_epi8(b_r, b_l, rising);
+        n1 = _mm256_blendv_epi8(n1, _mm256_loadu_si256((const __m256i *)(above + x)), up);
+        n2 = _mm256_blendv_epi8(n2, _mm256_loadu_si256((const __m256i *)(below + x)), up);
+        n1 = _mm256_blendv_epi8(n1, _mm256_loadu_si256((const __m256i *)(row + x - 1)), left);
+        n2 = _mm256_blendv_epi8(n2, _mm256_loadu_si256((const __m256i *)(row + x + 1)), left);
+
+        const __m256i keep = _mm256_andnot_si256(_mm256_cmpgt_epi32(n2, m),
+                                                 _mm256_and_si256(_mm256_cmpgt_epi32(m, low_v), _mm256_cmpgt_epi32(m, n1)));
+        const __m256i strong = _mm256_and_si256(keep, _mm256_cmpgt_epi32(m, high_v));
+        // keep and strong are -1 where set, so this is 0, 1 or 2
+        const __m256i value = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_add_epi32(keep, strong));
+
+        const __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(value, value), 0x08);
+        _mm_storel_epi64((__m128i *)(map + x), _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_castsi256_si128(words)));
+    }
+#endif
+
+    for (; x < width - 1; x++) {
+        const int m = row[x];
+        int n1, n2;
+        switch (dir[x]) {
+            case 0: n1 = row[x - 1]; n2 = row[x + 1]; break;
+            case 1: n1 = above[x]; n2 = below[x]; break;
+            case 2: n1 = above[x + 1]; n2 = below[x - 1]; break;
+            default: n1 = above[x - 1]; n2 = below[x + 1]; break;
+        }
+        map[x] = (m > low && m > n1 && m >= n2) ? ((m > high) ? 2 : 1) : 0;
+    }
+
+    map[0] = 0;
+    if (width > 1) map[width - 1] = 0;
+}
+
+// Copies a 0/255 mask into every channel but alpha of an interleaved row.
+static void mask_row(const unsigned char *mask, unsigned char *out, int width, int channels) {
+    const int colour = (channels == 4) ? 3 : channels;
+    int x = 0;
+
+#ifdef __AVX2__
+    if (channels == 1 || channels == 3 || channels == 4) {
+        for (; x + 16 <= width; x += 16) {
+            store_mask(_mm_loadu_si128((const __m128i *)(mask + x)), out + x * channels, channels);
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (int c = 0; c < colour; c++) out[x * channels + c] = mask[x];
+    }
+}
+
+#define KERNEL_TABLE_(isa) kernels_##isa
+#define KERNEL_TABLE(isa) KERNEL_TABLE_(isa)
+#define KERNEL_NAME_(isa) #isa
+#define KERNEL_NAME(isa) KERNEL_NAME_(isa)
+
+const KernelTable KERNEL_TABLE(KERNEL_ISA) = {
+    KERNEL_NAME(KERNEL_ISA),
+    matrix_row,
+    matrix_planar_row,
+    matrix_fixed_row,
+    matrix_fixed_planar_row,
+    invert_row,
+    brightness_row,
+    contrast_row,
+    brightness_fixed_row,
+    contrast_fixed_row,
+    lut_apply,
+    deinterleave_row,
+    interleave_row,
+    premultiply_row,
+    premultiply_planar_row,
+    unpremultiply_planar_row,
+    box_h_row,
+    box_v_row,
+    iir_forward_row,
+    iir_backward_row,
+    gray_row,
+    gray_planar_row,
+    edge_row,
+    canny_gradient_row,
+    canny_nms_row,
+    mask_row
+};
@@ -51,25 +51,43 @@ void log_close(void) {
     }
 }
 
+// Writes the line under the stream's lock, so concurrent workers never interleave.
+static void log_write(const char *level_name, const char *fmt, va_list args) {
+    time_t now = time(NULL);
+    struct tm tm_info;
+#ifdef _WIN32
+    localtime_s(&tm_info, &now);
+#else
+    localtime_r(&now, &tm_info);
+#endif
+    char time_str[26];
+    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", &tm_info);
+
+#ifdef _WIN32
+    _lock_file(log_file);
+#else
+    flockfile(log_file);
+#endif
+    fprintf(log_file, "[%s] [%s] ", time_str, level_name);
+    vfprintf(log_file, fmt, args);
+    fputc('\n', log_file);
+    fflush(log_file);
+#ifdef _WIN32
+    _unlock_file(log_file);
+#else
+    funlockfile(log_file);
+#endif
+}
+
 void log_message(LogLevel level, char *fmt, ...) {
     if (log_file == NULL || level < current_min_level) {
         return;
     }
 
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[26];
-    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(log_file, "[%s] [%s] ", time_str, level_names[level]);
-
     va_list args;
     va_start(args, fmt);
-    vfprintf(log_file,fmt, args);
+    log_write(level_names[level], fmt, args);
     va_end(args);
-
-    fprintf(log_file, "\n");
-    fflush(log_file);
 }
 
 void log_debug(const char *fmt, ...) {
@@ -79,18 +97,8 @@ void log_debug(const char *fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[26];
-    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(log_file, "[%s] [DEBUG] ", time_str);
-    vfprintf(log_file, fmt, args);
-    fprintf(log_file, "\n");
-
+    log_write("DEBUG", fmt, args);
     va_end(args);
-    fflush(log_file);
 }
 
 void log_info(const char *fmt, ...) {
@@ -100,18 +108,8 @@ void log_info(const char *fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[26];
-    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(log_file, "[%s] [INFO] ", time_str);
-    vfprintf(log_file, fmt, args);
-    fprintf(log_file, "\n");
-
+    log_write("INFO", fmt, args);
     va_end(args);
-    fflush(log_file);
 }
 
 void log_warning(const char *fmt, ...) {
@@ -121,18 +119,8 @@ void log_warning(const char *fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[26];
-    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(log_file, "[%s] [WARNING] ", time_str);
-    vfprintf(log_file, fmt, args);
-    fprintf(log_file, "\n");
-
+    log_write("WARNING", fmt, args);
     va_end(args);
-    fflush(log_file);
 }
 
 void log_error(const char *fmt, ...) {
@@ -142,18 +130,8 @@ void log_error(const char *fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[26];
-    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(log_file, "[%s] [ERROR] ", time_str);
-    vfprintf(log_file, fmt, args);
-    fprintf(log_file, "\n");
-
+    log_write("ERROR", fmt, args);
     va_end(args);
-    fflush(log_file);
 }
 
 void log_fatal(const char *fmt, ...) {
@@ -163,16 +141,6 @@ void log_fatal(const char *fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
-
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    char time_str[26];
-    strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-
-    fprintf(log_file, "[%s] [FATAL] ", time_str);
-    vfprintf(log_file, fmt, args);
-    fprintf(log_file, "\n");
-
+    log_write("FATAL", fmt, args);
     va_end(args);
-    fflush(log_file);
 }
\ No newline at end of file
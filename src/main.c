@@ -1,114 +1,23 @@
-#include "image_utils.h"
-#include "stb_include.h"
+#include "cli.h"
+#include "stb_image.h"
 #include "logger.h"
+#include "graph.h"
+#include "kernels.h"
 #include <omp.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-typedef enum {
-    ERROR_SUCCESS = 0,
-    ERROR_IO = 1,
-    ERROR_INVALID_ARGS = 2
-} ErrorCode;
-
-Filter filter[] = {
-    {"--grayscale", grayscale, 0,
-        "Convert image to grayscale", 0.0f, 0.0f},
-    {"--invert", invert, 0,
-        "Invert image colors", 0.0f, 0.0f},
-    {"--brightness", brightness, 1,
-        "Adjust brightness", 0.1f, 2.0f},
-    {"--contrast", contrast, 1,
-        "Adjust contrast", 0.1f, 2.0f},
-    {"--sepia", sepia, 0,
-        "Apply sepia effect", 0.0f, 0.0f},
-    {"--blur", gaussian_blur, 1,
-        "Apply Gaussian blur", 1.0f, 10.0f},
-    {"--edge", edge_detect, 1,
-        "Apply edge detection", 0.0f, 255.0f}
-    // {"--canny", canny_edge_detect_adapter, 1,
-    // "Apply Canny edge detection", 20.0f, 200.0f}
-
-};
-
-const int num_filters = sizeof(filter) / sizeof(Filter);
-
-void usage(const char* name) {
-    printf(stderr, "Usage: %s input.jpg output.jpg [--filter] [param value] [--benchmark]\n", name);
-    fprintf(stderr, "Available filters:\n");
-
-    for (int i = 0; i < num_filters; i++) {
-        if (filter[i].param) {
-            if (strcmp(filter[i].name, "--brightness") == 0) {
-                fprintf(stderr, "  %s [0.1-2.0] - %s\n", filter[i].name, filter[i].description);
-            }
-            else if (strcmp(filter[i].name, "--contrast") == 0) {
-                fprintf(stderr, "  %s [0.1-2.0] - %s\n", filter[i].name, filter[i].description);
-            }
-            else if (strcmp(filter[i].name, "--blur") == 0) {
-                fprintf(stderr, "  %s [1.0-10.0] - %s\n", filter[i].name, filter[i].description);
-            }
-            else if (strcmp(filter[i].name, "--edge") == 0) {
-                fprintf(stderr, "  %s [0.0-255.0] - %s\n", filter[i].name, filter[i].description);
-            }
-            else {
-                fprintf(stderr, "  %s [value] - %s\n", filter[i].name, filter[i].description);
-            }
-        } else {
-            fprintf(stderr, "  %s - %s\n", filter[i].name, filter[i].description);
-        }
-    }
-
-    fprintf(stderr, "  --benchmark - Compare single and multi-threaded execution\n");
-}
-
-int validate(const char* filter_name, float value) {
-    for (int i = 0; i < num_filters; i++) {
-        if (strcmp(filter_name, filter[i].name) == 0) {
-            if (!filter[i].param) {
-                return 1;
-            }
-
-            if (strcmp(filter_name, "--brightness") == 0) {
-                if (value < filter[i].min || value > filter[i].max) {
-                    fprintf(stderr, "Error: Brightness must be between %.1f and %.1f.\n",
-                            filter[i].min, filter[i].max);
-                    return 0;
-                }
-            }
-            else if (strcmp(filter_name, "--contrast") == 0) {
-                if (value < filter[i].min || value > filter[i].max) {
-                    fprintf(stderr, "Error: Contrast must be between %.1f and %.1f.\n",
-                            filter[i].min, filter[i].max);
-                    return 0;
-                }
-            }
-            else if (strcmp(filter_name, "--blur") == 0) {
-                if (value < filter[i].min || value > filter[i].max) {
-                    fprintf(stderr, "Error: Sigma must be between %.1f and %.1f\n",
-                            filter[i].min, filter[i].max);
-                    return 0;
-                }
-            }
-            else if (strcmp(filter_name, "--edge") == 0) {
-                if (value < filter[i].min || value > filter[i].max) {
-                    fprintf(stderr, "Error: Threshold must be between %.1f and %.1f.\n",
-                            filter[i].min, filter[i].max);
-                    return 0;
-                }
-            }
-
-            return 1;
-        }
-    }
-
-    return 0;
-}
+typedef struct {
+    const char *path;
+    int node;
+} SaveTarget;
 
-void cleanup(unsigned char *image, unsigned char *image_copy) {
-    if (image) stbi_image_free(image);
-    if (image_copy) free(image_copy);
+void cleanup(Image *image, Image *bench_image, FilterGraph *graph, SaveTarget *saves) {
+    image_free(image);
+    image_free(bench_image);
+    if (graph) graph_free(graph);
+    if (saves) free(saves);
     log_close();
 }
 
@@ -127,16 +36,16 @@ int main(int argc, char *argv[]) {
         return ERROR_INVALID_ARGS;
     }
 
-    if (argc > 1) {
-        printf("argc: %d\n%s\n", argc, file_format(argv[1]));
-        log_debug("Input file format: %s", file_format(argv[1]));
+    if (strcmp(argv[1], "--batch") == 0 || strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--client") == 0) {
+        int status;
+        if (strcmp(argv[1], "--batch") == 0) status = run_batch(argc, argv);
+        else if (strcmp(argv[1], "--serve") == 0) status = run_server(argc, argv);
+        else status = run_client(argc, argv);
+        log_info("Program completed with status %d", status);
+        log_close();
+        return status;
     }
 
-    int num_threads = omp_get_num_procs();
-    omp_set_num_threads(num_threads);
-    printf("Processing with %d threads\n", omp_get_max_threads());
-    log_info("Processing with %d threads", omp_get_max_threads());
-
     if (!is_valid_expression(argv[1]) || !is_valid_expression(argv[2])) {
         log_error("Unsupported file format: %s or %s", argv[1], argv[2]);
         fprintf(stderr, "Error: only .png & .jpg files supported\n");
@@ -145,159 +54,231 @@ int main(int argc, char *argv[]) {
     }
 
     log_info("Attempting to open file: %s", argv[1]);
-    FILE* input_file = fopen(argv[1], "rb");
-    if (!input_file) {
+    InputFile input;
+    if (!input_open(&input, argv[1])) {
         log_error("Cannot open file: %s", argv[1]);
         fprintf(stderr, "Error: could not open file %s\n", argv[1]);
         log_close();
         return ERROR_IO;
     }
-    log_debug("File successfully opened: %s", argv[1]);
+    log_debug("File successfully opened: %s (%zu bytes%s)", argv[1], input.size, input.mapped ? ", mapped" : "");
+
+    const char *format = data_format(input.data, input.size);
+    printf("argc: %d\n%s\n", argc, format);
+    log_debug("Input file format: %s", format);
 
-    setvbuf(input_file, NULL, _IOFBF, 1024 * 1024);
-    fclose(input_file);
+    int num_threads = omp_get_num_procs();
+    omp_set_num_threads(num_threads);
+    printf("Processing with %d threads\n", omp_get_max_threads());
+    log_info("Processing with %d threads", omp_get_max_threads());
+    log_info("Using %s kernels", kernels->isa);
+    const int numa_nodes = numa_bind_threads();
+    log_info("NUMA placement: %s, threads bound to %d nodes", numa_policy_name(), numa_nodes);
 
-    int width, height, channels;
     log_info("Loading image: %s", argv[1]);
-    unsigned char *image = stbi_load(argv[1], &width, &height, &channels, 0);
+    Image image;
+    const int decoded = image_decode(&image, input.data, input.size);
+    input_close(&input);
 
-    if (image == NULL) {
+    if (!decoded) {
         log_error("Failed to load image %s. Reason: %s", argv[1], stbi_failure_reason());
         fprintf(stderr, "Error: failed to load image %s. Reason: %s\n", argv[1], stbi_failure_reason());
         log_close();
         return ERROR_IO;
     }
-    printf("%s Image: %dx%d, Channels: %d\n", file_format(argv[1]), width, height, channels);
-    log_info("Image loaded: %s, %dx%d, %d channels", file_format(argv[1]), width, height, channels);
+    const int width = image.width;
+    const int height = image.height;
+    const int channels = image.channels;
+    printf("%s Image: %dx%d, Channels: %d\n", format, width, height, channels);
+    log_info("Image loaded: %s, %dx%d, %d channels", format, width, height, channels);
 
     int benchmark_mode = 0;
+    int hugepage_report = 0;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--benchmark") == 0) {
             benchmark_mode = 1;
-            for (int j = i; j < argc - 1; j++) {
-                argv[j] = argv[j + 1];
-            }
-            argc--;
-            break;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            use_streaming = 1;
+        } else if (strcmp(argv[i], "--planar") == 0) {
+            use_planar = 1;
+        } else if (strcmp(argv[i], "--fixed") == 0) {
+            use_fixed_point = 1;
+        } else if (strcmp(argv[i], "--hugepage-report") == 0) {
+            hugepage_report = 1;
+        } else {
+            continue;
+        }
+
+        for (int j = i; j < argc - 1; j++) {
+            argv[j] = argv[j + 1];
         }
+        argc--;
+        i--;
+    }
+
+    if (benchmark_mode && use_streaming) {
+        log_error("--stream cannot be combined with --benchmark");
+        fprintf(stderr, "Error: --stream cannot be combined with --benchmark\n");
+        image_free(&image);
+        log_close();
+        return ERROR_INVALID_ARGS;
+    }
+    if (benchmark_mode && use_planar) {
+        log_error("--planar cannot be combined with --benchmark");
+        fprintf(stderr, "Error: --planar cannot be combined with --benchmark\n");
+        image_free(&image);
+        log_close();
+        return ERROR_INVALID_ARGS;
+    }
+    if (use_fixed_point) {
+        log_info("Fixed-point mode: colour filters use Q%d integer arithmetic", FIXED_SHIFT);
+    }
+    if (use_planar) {
+        log_info("Planar mode: blur/edge segments run on one plane per channel");
+    }
+    if (use_streaming) {
+        log_info("Streaming mode: neighbourhood filters run in bands of %d rows", STREAM_BAND_ROWS);
     }
 
-    unsigned char *image_copy = NULL;
+    Image bench_image = {0};
     if (benchmark_mode) {
         log_info("Running in benchmark mode");
         log_debug("Allocating memory for image copy: %d bytes", width * height * channels);
-        image_copy = (unsigned char *)malloc(width * height * channels);
-        if (!image_copy) {
+        if (!image_alloc(&bench_image, width, height, channels)) {
             log_error("Failed to allocate memory for image copy (%d bytes)", width * height * channels);
             fprintf(stderr, "Error: failed to allocate memory for image benchmark\n");
-            stbi_image_free(image);
+            image_free(&image);
             log_close();
             return ERROR_IO;
         }
     }
 
+    FilterGraph *graph = NULL;
+    if (!benchmark_mode) {
+        graph = graph_create(&image);
+        if (!graph) {
+            log_error("Failed to allocate filter graph");
+            fprintf(stderr, "Error: failed to allocate filter graph\n");
+            cleanup(&image, &bench_image, NULL, NULL);
+            return ERROR_IO;
+        }
+    }
+
+    SaveTarget *saves = (SaveTarget *)malloc(argc * sizeof(SaveTarget));
+    if (!saves) {
+        log_error("Failed to allocate output list (%d entries)", argc);
+        fprintf(stderr, "Error: failed to allocate output list\n");
+        cleanup(&image, &bench_image, graph, NULL);
+        return ERROR_IO;
+    }
+    int num_saves = 0;
+    int node = GRAPH_SOURCE;
+
     for (int i = 3; i < argc; i++) {
-        int filter_found = 0;
-
-        for (int j = 0; j < num_filters; j++) {
-            if (strcmp(argv[i], filter[j].name) == 0) {
-                filter_found = 1;
-                float param = 1.0f;
-
-                if (filter[j].param) {
-                    if (i + 1 >= argc || !is_number(argv[i + 1])) {
-                        log_error("Filter %s requires a numeric parameter", filter[j].name);
-                        fprintf(stderr, "Error: %s requires a numeric parameter\n", filter[j].name);
-                        cleanup(image, image_copy);
-                        return ERROR_INVALID_ARGS;
-                    }
-
-                    param = tmp_atof(argv[i + 1]);
-
-                    if (!validate(filter[j].name, param)) {
-                        log_error("Invalid parameter value %.2f for filter %s", param, filter[j].name);
-                        cleanup(image, image_copy);
-                        return ERROR_INVALID_ARGS;
-                    }
-
-                    log_info("Applying filter %s with parameter %.2f", filter[j].name, param);
-                    i++;
-                } else {
-                    log_info("Applying filter %s", filter[j].name);
+        if (strcmp(argv[i], "--save") == 0) {
+            if (i + 1 >= argc || !is_valid_expression(argv[i + 1])) {
+                log_error("--save requires a .png or .jpg path");
+                fprintf(stderr, "Error: --save requires a .png or .jpg path\n");
+                cleanup(&image, &bench_image, graph, saves);
+                return ERROR_INVALID_ARGS;
+            }
+
+            i++;
+            if (benchmark_mode) {
+                int status = save_image(argv[i], &image);
+                if (status != ERROR_SUCCESS) {
+                    cleanup(&image, &bench_image, graph, saves);
+                    return status;
                 }
+            } else {
+                graph_request(graph, node);
+                saves[num_saves].path = argv[i];
+                saves[num_saves].node = node;
+                num_saves++;
+            }
+            continue;
+        }
 
-                if (benchmark_mode) {
-                    memcpy(image_copy, image, width * height * channels);
+        ChainStep step;
+        int status = parse_filter(argc, argv, &i, &step, 1);
+        if (status != ERROR_SUCCESS) {
+            cleanup(&image, &bench_image, graph, saves);
+            return status;
+        }
 
-                    use_thread = 1;
-                    double mt_time = filter_time(filter[j].func, image, width, height, channels, param);
+        if (benchmark_mode) {
+            image_copy(&bench_image, &image);
 
-                    use_thread = 0;
-                    double st_time = filter_time(filter[j].func, image_copy, width, height, channels, param);
+            use_thread = 1;
+            double mt_time = filter_time(step.filter->func, &image, step.param);
 
-                    use_thread = 1;
+            use_thread = 0;
+            double st_time = filter_time(step.filter->func, &bench_image, step.param);
 
-                    printf("\n--- Performance Benchmark for %s ---\n", filter[j].name);
-                    printf("Multi-threaded execution time: %.6f seconds\n", mt_time);
-                    printf("Single-threaded execution time: %.6f seconds\n", st_time);
-                    printf("Speedup: %.2fx\n", st_time / mt_time);
-                    printf("------------------------------------------\n");
+            use_thread = 1;
 
-                    log_info("Benchmark for filter %s: multi-threaded - %.6f s, single-threaded - %.6f s, speedup - %.2fx",
-                              filter[j].name, mt_time, st_time, st_time / mt_time);
-                } else {
-                    filter[j].func(image, width, height, channels, param);
-                }
-                break;
+            printf("\n--- Performance Benchmark for %s ---\n", step.filter->name);
+            printf("Multi-threaded execution time: %.6f seconds\n", mt_time);
+            printf("Single-threaded execution time: %.6f seconds\n", st_time);
+            printf("Speedup: %.2fx\n", st_time / mt_time);
+            printf("Kernels: %s\n", kernels->isa);
+            printf("------------------------------------------\n");
+
+            log_info("Benchmark for filter %s: multi-threaded - %.6f s, single-threaded - %.6f s, speedup - %.2fx, %s kernels",
+                      step.filter->name, mt_time, st_time, st_time / mt_time, kernels->isa);
+        } else {
+            node = graph_add(graph, node, step.filter, step.param);
+            if (node < 0) {
+                log_error("Failed to add filter %s to the graph", step.filter->name);
+                fprintf(stderr, "Error: failed to allocate filter graph\n");
+                cleanup(&image, &bench_image, graph, saves);
+                return ERROR_IO;
             }
         }
+    }
 
-        if (!filter_found) {
-            log_error("Unknown filter: %s", argv[i]);
-            fprintf(stderr, "Error: Unknown filter: %s\n", argv[i]);
-            usage(argv[0]);
-            cleanup(image, image_copy);
-            return ERROR_INVALID_ARGS;
+    if (benchmark_mode) {
+        int status = save_image(argv[2], &image);
+        if (status != ERROR_SUCCESS) {
+            cleanup(&image, &bench_image, graph, saves);
+            return status;
+        }
+    } else {
+        graph_request(graph, node);
+        saves[num_saves].path = argv[2];
+        saves[num_saves].node = node;
+        num_saves++;
+
+        if (!graph_evaluate(graph)) {
+            log_error("Failed to evaluate filter graph");
+            fprintf(stderr, "Error: failed to allocate memory for filter graph\n");
+            cleanup(&image, &bench_image, graph, saves);
+            return ERROR_IO;
         }
-    }
 
-    log_info("Saving result to file: %s", argv[2]);
-    const char *ext = strrchr(argv[2], '.');
-    if (ext != NULL) {
-        if (strstr(ext, ".jpg") || strstr(ext, ".jpeg")) {
-            log_debug("Saving in JPEG format with quality %d", JPEG_QUALITY);
-            if (!stbi_write_jpg(argv[2], width, height, channels, image, JPEG_QUALITY)) {
-                log_error("Failed to write JPEG file: %s", argv[2]);
-                fprintf(stderr, "Error: failed to write JPEG file %s\n", argv[2]);
-                cleanup(image, image_copy);
-                return ERROR_IO;
-            }
-        } else if (strstr(ext, ".png")) {
-            log_debug("Saving in PNG format");
-            if(!stbi_write_png(argv[2], width, height, channels, image, width * channels)) {
-                log_error("Failed to write PNG file: %s", argv[2]);
-                fprintf(stderr, "Error: failed to write PNG file %s\n", argv[2]);
-                cleanup(image, image_copy);
-                return ERROR_IO;
+        for (int i = 0; i < num_saves; i++) {
+            int status = save_image(saves[i].path, graph_output(graph, saves[i].node));
+            if (status != ERROR_SUCCESS) {
+                cleanup(&image, &bench_image, graph, saves);
+                return status;
             }
         }
-    } else {
-        log_error("Output file has no extension: %s", argv[2]);
-        fprintf(stderr, "Error: output file has no extension\n");
-        cleanup(image, image_copy);
-        return ERROR_INVALID_ARGS;
     }
 
-    log_info("File successfully saved: %s", argv[2]);
+    if (hugepage_report) {
+        log_huge_pages();
+    }
 
     log_debug("Freeing image memory");
-    stbi_image_free(image);
-    if (image_copy) {
+    image_free(&image);
+    graph_free(graph);
+    if (bench_image.data) {
         log_debug("Freeing image copy memory");
-        free(image_copy);
+        image_free(&bench_image);
     }
+    free(saves);
 
     log_info("Program completed successfully");
     log_close();
     return ERROR_SUCCESS;
-}
\ No newline at end of file
+}
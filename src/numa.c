@@ -0,0 +1,205 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include "image_utils.h"
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define NUMA_MAX_NODES 1024
+#define NUMA_PAGE 4096
+
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+
+typedef enum {
+    NUMA_OFF,
+    NUMA_FIRST_TOUCH,
+    NUMA_INTERLEAVE,
+    NUMA_BIND
+} NumaPolicy;
+
+static NumaPolicy numa_policy = NUMA_FIRST_TOUCH;
+static unsigned long numa_nodes[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+
+// Sets the bits of a list like "0-3,8" in mask; 0 if it is malformed or names no bit below bits.
+static int parse_list(const char *list, unsigned long *mask, int bits) {
+    const int word = 8 * sizeof(unsigned long);
+    int found = 0;
+
+    while (*list && *list != '\n') {
+        char *end;
+        const long first = strtol(list, &end, 10);
+        long last = first;
+        if (end == list || first < 0) return 0;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first) return 0;
+        }
+        for (long i = first; i <= last && i < bits; i++) {
+            mask[i / word] |= 1UL << (i % word);
+            found = 1;
+        }
+        list = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',' && *end != '\n') return 0;
+    }
+    return found;
+}
+
+#ifdef __linux__
+// The first line of a sysfs file, or 0 if it cannot be read.
+static int read_line(const char *path, char *line, int size) {
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+    const int ok = fgets(line, size, file) != NULL;
+    fclose(file);
+    return ok;
+}
+
+/**
+ * IMG_ED_NUMA picks where the pages of new image buffers go:
+ * first-touch (the default) touches them in parallel with the filters'
+ * static row partition, interleave spreads them over all nodes for work
+ * that does not follow the rows, bind:<nodes> (e.g. bind:1 or bind:0-1)
+ * keeps them on those nodes, and off leaves placement to the kernel.
+ */
+__attribute__((constructor))
+static void select_numa_policy(void) {
+    const char *policy = getenv("IMG_ED_NUMA");
+    char line[4096];
+    unsigned long online[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    const int have_nodes = read_line("/sys/devices/system/node/online", line, sizeof(line)) &&
+                           parse_list(line, online, NUMA_MAX_NODES);
+
+    // bind keeps only the nodes that exist, so a typo cannot make mbind fail on every buffer
+    int bind_nodes = 0;
+    if (policy && strncmp(policy, "bind:", 5) == 0 && have_nodes && parse_list(policy + 5, numa_nodes, NUMA_MAX_NODES)) {
+        for (size_t i = 0; i < sizeof(numa_nodes) / sizeof(numa_nodes[0]); i++) {
+            numa_nodes[i] &= online[i];
+            bind_nodes |= numa_nodes[i] != 0;
+        }
+    }
+
+    if (!policy || !*policy || strcmp(policy, "first-touch") == 0) {
+        numa_policy = NUMA_FIRST_TOUCH;
+    } else if (strcmp(policy, "off") == 0) {
+        numa_policy = NUMA_OFF;
+    } else if (strcmp(policy, "interleave") == 0 && have_nodes) {
+        memcpy(numa_nodes, online, sizeof(online));
+        numa_policy = NUMA_INTERLEAVE;
+    } else if (bind_nodes) {
+        numa_policy = NUMA_BIND;
+    } else {
+        fprintf(stderr, "Warning: ignoring IMG_ED_NUMA=%s, expected off, first-touch, interleave or bind:<online nodes>\n",
+                policy);
+    }
+}
+#endif
+
+const char *numa_policy_name(void) {
+    switch (numa_policy) {
+        case NUMA_OFF: return "off";
+        case NUMA_INTERLEAVE: return "interleave";
+        case NUMA_BIND: return "bind";
+        default: return "first-touch";
+    }
+}
+
+/**
+ * Places a fresh mapping before anything writes to it. Under first-touch
+ * every page is touched by the thread whose rows it will hold in a
+ * schedule(static) loop over the image, so the decoder, which writes all
+ * pixels from one thread, no longer puts the whole image on its node.
+ */
+void numa_place(void *data, size_t size) {
+#ifdef __linux__
+    if (numa_policy == NUMA_INTERLEAVE || numa_policy == NUMA_BIND) {
+        syscall(SYS_mbind, data, size, (numa_policy == NUMA_INTERLEAVE) ? MPOL_INTERLEAVE : MPOL_BIND,
+                numa_nodes, NUMA_MAX_NODES + 1, 0);
+        return;
+    }
+#endif
+
+    if (numa_policy != NUMA_FIRST_TOUCH || !use_thread || omp_in_parallel() || omp_get_max_threads() < 2) {
+        return;
+    }
+
+    unsigned char *bytes = (unsigned char *)data;
+    const long pages = (long)((size + NUMA_PAGE - 1) / NUMA_PAGE);
+
+    #pragma omp parallel for schedule(static)
+    for (long p = 0; p < pages; p++) {
+        bytes[(size_t)p * NUMA_PAGE] = 0;
+    }
+}
+
+/**
+ * Binds each OpenMP thread to the CPUs of one NUMA node, consecutive
+ * threads to the same node, so thread t stays next to the rows it first
+ * touched. Nothing is changed when the runtime already binds threads
+ * (OMP_PROC_BIND / OMP_PLACES), when placement is off, or when the
+ * process may only run on one node. Returns the number of nodes used.
+ */
+int numa_bind_threads(void) {
+#ifdef __linux__
+    if (numa_policy == NUMA_OFF || omp_get_proc_bind() != omp_proc_bind_false) {
+        return 0;
+    }
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+
+    char line[4096];
+    unsigned long online[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    if (!read_line("/sys/devices/system/node/online", line, sizeof(line)) ||
+        !parse_list(line, online, NUMA_MAX_NODES)) {
+        return 0;
+    }
+
+    cpu_set_t *node_cpus = (cpu_set_t *)malloc(NUMA_MAX_NODES * sizeof(cpu_set_t));
+    if (!node_cpus) {
+        return 0;
+    }
+
+    const int word = 8 * sizeof(unsigned long);
+    int num_nodes = 0;
+    for (int node = 0; node < NUMA_MAX_NODES; node++) {
+        if (!(online[node / word] & (1UL << (node % word)))) continue;
+
+        char path[64];
+        unsigned long cpus[CPU_SETSIZE / (8 * sizeof(unsigned long))] = {0};
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (!read_line(path, line, sizeof(line)) || !parse_list(line, cpus, CPU_SETSIZE)) continue;
+
+        CPU_ZERO(&node_cpus[num_nodes]);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if ((cpus[cpu / word] & (1UL << (cpu % word))) && CPU_ISSET(cpu, &allowed)) {
+                CPU_SET(cpu, &node_cpus[num_nodes]);
+            }
+        }
+        if (CPU_COUNT(&node_cpus[num_nodes]) > 0) num_nodes++;
+    }
+
+    if (num_nodes > 1) {
+        #pragma omp parallel
+        {
+            const int node = (int)((long)omp_get_thread_num() * num_nodes / omp_get_num_threads());
+            sched_setaffinity(0, sizeof(cpu_set_t), &node_cpus[node]);
+        }
+    }
+
+    free(node_cpus);
+    return (num_nodes > 1) ? num_nodes : 0;
+#else
+    return 0;
+#endif
+}
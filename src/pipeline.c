@@ -0,0 +1,679 @@
+#include "pipeline.h"
+#include "kernels.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int use_streaming = 0;
+int use_planar = 0;
+
+static int is_channel_op(PointOp op) {
+    return op == POINT_INVERT || op == POINT_BRIGHTNESS || op == POINT_CONTRAST;
+}
+
+// Per-channel ops fold into a table for any channel count; colour matrices need RGB.
+static int is_point_step(const ChainStep *step, int channels) {
+    const PointOp op = step->filter->point;
+    return op != POINT_NONE && (channels == 3 || channels == 4 || is_channel_op(op));
+}
+
+static int matrix_is_identity(const float m[3][4]) {
+    static const float identity[3][4] = {
+        {1.0f, 0.0f, 0.0f, 0.0f},
+        {0.0f, 1.0f, 0.0f, 0.0f},
+        {0.0f, 0.0f, 1.0f, 0.0f}
+    };
+    return memcmp(m, identity, sizeof(identity)) == 0;
+}
+
+static int matrix_makes_gray(const float m[3][4]) {
+    return memcmp(m[0], m[1], 4 * sizeof(float)) == 0 && memcmp(m[0], m[2], 4 * sizeof(float)) == 0;
+}
+
+// Runs every gray level through the real kernel so the answer includes its rounding.
+static int matrix_on_gray(const float m[3][4], int fixed_point, int *keeps_gray) {
+    int fixes_gray = 1;
+    *keeps_gray = 1;
+
+    int q[3][4];
+    if (fixed_point) color_matrix_fixed(q, m);
+
+    for (int v = 0; v < 256; v++) {
+        unsigned char px[3] = {(unsigned char)v, (unsigned char)v, (unsigned char)v};
+        if (fixed_point) color_matrix_fixed_row(px, 1, 3, (const int (*)[4])q);
+        else color_matrix_row(px, 1, 3, m);
+
+        if (px[0] != px[1] || px[0] != px[2]) *keeps_gray = 0;
+        if (px[0] != v || px[1] != v || px[2] != v) fixes_gray = 0;
+    }
+
+    return fixes_gray;
+}
+
+// True when no input can leave [0, 255], so no clamp is lost by composing past it.
+static int matrix_in_gamut(const float m[3][4]) {
+    for (int i = 0; i < 3; i++) {
+        float lo = m[i][3];
+        float hi = m[i][3];
+        for (int j = 0; j < 3; j++) {
+            if (m[i][j] > 0.0f) hi += m[i][j] * 255.0f;
+            else lo += m[i][j] * 255.0f;
+        }
+        if (lo < -0.5f || hi >= 255.5f) return 0;
+    }
+    return 1;
+}
+
+// first = second * first, treating both as affine maps over RGB
+static void matrix_compose(float first[3][4], const float second[3][4]) {
+    float out[3][4];
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            float sum = (j == 3) ? second[i][3] : 0.0f;
+            for (int k = 0; k < 3; k++) {
+                sum += second[i][k] * first[k][j];
+            }
+            out[i][j] = sum;
+        }
+    }
+
+    memcpy(first, out, sizeof(out));
+}
+
+// Drops steps that cannot change the pixels: unit brightness/contrast,
+// an invert undone by the next one, identity matrices and gray-preserving
+// matrices (grayscale, saturation) on pixels that are already gray.
+static int plan_point_run(PointStep *ops, const ChainStep *steps, int count,
+                          float (*matrices)[3][4], int *num_matrices, int fixed_point) {
+    int num_ops = 0;
+    int is_gray = 0;
+
+    for (int i = 0; i < count; i++) {
+        const PointOp op = steps[i].filter->point;
+        const float param = steps[i].param;
+        float (*m)[4] = NULL;
+
+        switch (op) {
+            case POINT_BRIGHTNESS:
+            case POINT_CONTRAST:
+                if (param == 1.0f) continue;
+                break;
+            case POINT_INVERT:
+                if (num_ops > 0 && ops[num_ops - 1].op == POINT_INVERT) {
+                    num_ops--;
+                    continue;
+                }
+                break;
+            case POINT_MATRIX: {
+                m = matrices[*num_matrices];
+                steps[i].filter->matrix(m, param);
+                if (matrix_is_identity((const float (*)[4])m)) continue;
+
+                int keeps_gray;
+                const int fixes_gray = matrix_on_gray((const float (*)[4])m, fixed_point, &keeps_gray);
+                if (is_gray && fixes_gray) continue;
+
+                is_gray = matrix_makes_gray((const float (*)[4])m) || (is_gray && keeps_gray);
+                (*num_matrices)++;
+                break;
+            }
+            default:
+                break;
+        }
+
+        ops[num_ops].op = op;
+        ops[num_ops].param = param;
+        ops[num_ops].matrix = (const float (*)[4])m;
+        ops[num_ops].fixed = NULL;
+        ops[num_ops].lut = NULL;
+        ops[num_ops].lut_uniform = 0;
+        num_ops++;
+    }
+
+    return num_ops;
+}
+
+#define COMPOSE_MAX_ERROR 0.75f
+#define COMPOSE_GAIN_SLACK 1e-4f  // float row sums of gain-1 matrices such as grayscale
+
+// The most op can stretch a difference between two inputs: the factor of
+// brightness/contrast, a matrix's largest absolute row sum, 1 otherwise.
+static float point_gain(const PointStep *op) {
+    if (op->op == POINT_BRIGHTNESS || op->op == POINT_CONTRAST) {
+        return op->param;
+    }
+    if (op->op != POINT_MATRIX) {
+        return 1.0f;
+    }
+
+    float gain = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        const float row = fabsf(op->matrix[i][0]) + fabsf(op->matrix[i][1]) + fabsf(op->matrix[i][2]);
+        if (row > gain) gain = row;
+    }
+    return gain;
+}
+
+/**
+ * Multiplies consecutive colour matrices into one while the earlier one
+ * cannot clip; a clipping matrix (e.g. sepia) starts a new product.
+ *
+ * Each skipped rounding is an error of up to 0.5 that the later matrices
+ * scale by their gain. A matrix is only folded in while that stays below
+ * COMPOSE_MAX_ERROR, which leaves room for Q12 quantization in fixed-point
+ * mode, so the product's bytes are within 1 of step-by-step application.
+ * Ops with a gain of at most 1 keep them within 1; a later op of the run
+ * with a larger gain (e.g. --brightness 2.0) would scale the difference
+ * too, so no matrix ahead of it is folded.
+ */
+static int compose_matrices(PointStep *ops, int num_ops) {
+    int out = 0;
+    float error = 0.0f;
+
+    for (int i = 0; i < num_ops; i++) {
+        int amplified = 0;
+        for (int j = i + 1; j < num_ops && !amplified; j++) {
+            amplified = point_gain(&ops[j]) > 1.0f + COMPOSE_GAIN_SLACK;
+        }
+
+        if (out > 0 && ops[i].op == POINT_MATRIX && ops[out - 1].op == POINT_MATRIX &&
+            matrix_in_gamut(ops[out - 1].matrix) && !amplified &&
+            point_gain(&ops[i]) * (error + 0.5f) <= COMPOSE_MAX_ERROR) {
+            matrix_compose((float (*)[4])ops[out - 1].matrix, ops[i].matrix);
+            error = point_gain(&ops[i]) * (error + 0.5f);
+            continue;
+        }
+        ops[out++] = ops[i];
+        error = 0.0f;
+    }
+
+    return out;
+}
+
+static void compose_lut(unsigned char lut[4][256], PointOp op, float param, int fixed_point) {
+    const int factor = fixed_from_float(param);
+
+    for (int c = 0; c < 4; c++) {
+        for (int v = 0; v < 256; v++) {
+            int value = lut[c][v];
+
+            if (op == POINT_INVERT) {
+                if (c < 3) value = 255 - value;
+            } else if (op == POINT_BRIGHTNESS && fixed_point) {
+                value = brightness_fixed(value, factor);
+            } else if (op == POINT_CONTRAST && fixed_point) {
+                value = contrast_fixed(value, factor);
+            } else if (op == POINT_BRIGHTNESS) {
+                float new_val = value * param;
+                value = (new_val > 255.0f) ? 255 : (unsigned char)new_val;
+            } else if (op == POINT_CONTRAST) {
+                value = CLAMP(param * (value - 128) + 128);
+            }
+
+            lut[c][v] = (unsigned char)value;
+        }
+    }
+}
+
+// Replaces every run of invert/brightness/contrast with one table lookup.
+static int compile_luts(PointStep *ops, int num_ops, unsigned char (*luts)[4][256], int *num_luts, int channels,
+                        int fixed_point) {
+    int out = 0;
+    int i = 0;
+
+    while (i < num_ops) {
+        if (!is_channel_op(ops[i].op)) {
+            ops[out++] = ops[i++];
+            continue;
+        }
+
+        unsigned char (*lut)[256] = luts[(*num_luts)++];
+        for (int c = 0; c < 4; c++) {
+            for (int v = 0; v < 256; v++) lut[c][v] = (unsigned char)v;
+        }
+
+        while (i < num_ops && is_channel_op(ops[i].op)) {
+            compose_lut(lut, ops[i].op, ops[i].param, fixed_point);
+            i++;
+        }
+
+        int uniform = 1;
+        for (int c = 1; c < channels; c++) {
+            if (memcmp(lut[0], lut[c], 256) != 0) uniform = 0;
+        }
+
+        ops[out].op = POINT_LUT;
+        ops[out].param = 0.0f;
+        ops[out].matrix = NULL;
+        ops[out].fixed = NULL;
+        ops[out].lut = (const unsigned char (*)[256])lut;
+        ops[out].lut_uniform = uniform;
+        out++;
+    }
+
+    return out;
+}
+
+int chain_plan(ChainPlan *plan, const ChainStep *steps, int num_steps, int channels, int fixed_point) {
+    plan->stages = NULL;
+    plan->num_stages = 0;
+    plan->ops = NULL;
+    plan->luts = NULL;
+    plan->matrices = NULL;
+    plan->fixed_matrices = NULL;
+    plan->streaming = use_streaming;
+    plan->planar = use_planar;
+    plan->fixed_point = fixed_point;
+
+    if (num_steps == 0) {
+        return 1;
+    }
+
+    plan->stages = (ChainStage *)malloc(num_steps * sizeof(ChainStage));
+    plan->ops = (PointStep *)malloc(num_steps * sizeof(PointStep));
+    plan->luts = malloc(num_steps * sizeof(*plan->luts));
+    plan->matrices = malloc(num_steps * sizeof(*plan->matrices));
+    plan->fixed_matrices = malloc(num_steps * sizeof(*plan->fixed_matrices));
+    if (!plan->stages || !plan->ops || !plan->luts || !plan->matrices || !plan->fixed_matrices) {
+        chain_free(plan);
+        return 0;
+    }
+
+    int num_ops = 0;
+    int num_luts = 0;
+    int num_matrices = 0;
+    int num_fixed = 0;
+    int i = 0;
+    while (i < num_steps) {
+        if (!is_point_step(&steps[i], channels)) {
+            ChainStage *stage = &plan->stages[plan->num_stages++];
+            stage->filter = steps[i].filter;
+            stage->param = steps[i].param;
+            stage->ops = NULL;
+            stage->num_ops = 0;
+            i++;
+            continue;
+        }
+
+        int run_end = i;
+        while (run_end < num_steps && is_point_step(&steps[run_end], channels)) {
+            run_end++;
+        }
+
+        int run_ops = plan_point_run(plan->ops + num_ops, steps + i, run_end - i, plan->matrices, &num_matrices,
+                                     fixed_point);
+        run_ops = compose_matrices(plan->ops + num_ops, run_ops);
+        run_ops = compile_luts(plan->ops + num_ops, run_ops, plan->luts, &num_luts, channels, fixed_point);
+
+        for (int j = 0; j < run_ops && fixed_point; j++) {
+            PointStep *op = &plan->ops[num_ops + j];
+            if (op->op == POINT_MATRIX) {
+                color_matrix_fixed(plan->fixed_matrices[num_fixed], op->matrix);
+                op->fixed = (const int (*)[4])plan->fixed_matrices[num_fixed++];
+            }
+        }
+        if (run_ops > 0) {
+            ChainStage *stage = &plan->stages[plan->num_stages++];
+            stage->filter = NULL;
+            stage->param = 0.0f;
+            stage->ops = plan->ops + num_ops;
+            stage->num_ops = run_ops;
+            num_ops += run_ops;
+        }
+
+        i = run_end;
+    }
+
+    return 1;
+}
+
+void chain_free(ChainPlan *plan) {
+    free(plan->stages);
+    free(plan->ops);
+    free(plan->luts);
+    free(plan->matrices);
+    free(plan->fixed_matrices);
+    plan->stages = NULL;
+    plan->ops = NULL;
+    plan->luts = NULL;
+    plan->matrices = NULL;
+    plan->fixed_matrices = NULL;
+    plan->num_stages = 0;
+}
+
+static void lut_row(unsigned char *row, int width, int channels, const PointStep *step) {
+    if (step->lut_uniform) {
+        kernels->lut_apply(row, width * channels, step->lut[0]);
+        return;
+    }
+
+    for (int x = 0; x < width; x++) {
+        const int idx = x * channels;
+        for (int c = 0; c < channels; c++) {
+            row[idx + c] = step->lut[c][row[idx + c]];
+        }
+    }
+}
+
+static void point_ops_row(unsigned char *row, int width, int channels, const PointStep *ops, int num_ops) {
+    for (int i = 0; i < num_ops; i++) {
+        switch (ops[i].op) {
+            case POINT_MATRIX:
+                if (ops[i].fixed) color_matrix_fixed_row(row, width, channels, ops[i].fixed);
+                else color_matrix_row(row, width, channels, ops[i].matrix);
+                break;
+            case POINT_LUT:
+                lut_row(row, width, channels, &ops[i]);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void point_ops_planar_row(const Image *image, int y, const PointStep *ops, int num_ops) {
+    for (int i = 0; i < num_ops; i++) {
+        switch (ops[i].op) {
+            case POINT_MATRIX:
+                if (ops[i].fixed) {
+                    color_matrix_fixed_planar_row(image_plane_row(image, 0, y), image_plane_row(image, 1, y),
+                                                  image_plane_row(image, 2, y), image->width, ops[i].fixed);
+                } else {
+                    color_matrix_planar_row(image_plane_row(image, 0, y), image_plane_row(image, 1, y),
+                                            image_plane_row(image, 2, y), image->width, ops[i].matrix);
+                }
+                break;
+            case POINT_LUT:
+                for (int c = 0; c < image->channels; c++) {
+                    kernels->lut_apply(image_plane_row(image, c, y), image->width, ops[i].lut_uniform ? ops[i].lut[0] : ops[i].lut[c]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static void point_ops_image_row(const Image *image, int y, const ChainStage *stage) {
+    if (image->flags & IMAGE_PLANAR) {
+        point_ops_planar_row(image, y, stage->ops, stage->num_ops);
+    } else {
+        point_ops_row(image_row(image, y), image->width, image->channels, stage->ops, stage->num_ops);
+    }
+}
+
+static void run_point_stage(const ChainStage *stage, Image *image) {
+    if (USE_THREADS_FOR(image->width * image->height)) {
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < image->height; y++) {
+            point_ops_image_row(image, y, stage);
+        }
+    } else {
+        for (int y = 0; y < image->height; y++) {
+            point_ops_image_row(image, y, stage);
+        }
+    }
+}
+
+static void run_stage(const ChainStage *stage, Image *image) {
+    if (stage->filter && (image->flags & IMAGE_PLANAR)) {
+        stage->filter->planar(image, stage->param);
+    } else if (stage->filter) {
+        stage->filter->func(image, stage->param);
+    } else {
+        run_point_stage(stage, image);
+    }
+}
+
+// Neighbourhood reach of a stage in pixels, or -1 when it cannot be tiled.
+static int stage_radius(const ChainStage *stage) {
+    if (!stage->filter) return 0;
+    if (stage->filter->radius) return stage->filter->radius(stage->param);
+    return -1;
+}
+
+static int stage_has_planar(const ChainStage *stage) {
+    return !stage->filter || stage->filter->planar;
+}
+
+typedef struct {
+    const ChainStage *stages;
+    int num_stages;
+    int halo;
+    int tile_w;
+    int tile_h;
+} TileJob;
+
+/**
+ * Runs the whole segment on one tile. The tile is copied with a halo of
+ * the summed stage radii (clipped at the image border, where the filters'
+ * own edge handling applies), so every pixel inside the tile sees the same
+ * neighbourhood it would see on the full image. local is a scratch image
+ * big enough for any tile plus halo; the tile uses a view of its top-left.
+ * When local is planar the two copies also convert between layouts.
+ */
+static void run_tile(const TileJob *job, int tile, const Image *src, Image *dst, const Image *local) {
+    const int width = src->width;
+    const int height = src->height;
+    const int tiles_x = (width + job->tile_w - 1) / job->tile_w;
+    const int x0 = (tile % tiles_x) * job->tile_w;
+    const int y0 = (tile / tiles_x) * job->tile_h;
+    const int x1 = (x0 + job->tile_w < width) ? x0 + job->tile_w : width;
+    const int y1 = (y0 + job->tile_h < height) ? y0 + job->tile_h : height;
+
+    const int lx0 = (x0 - job->halo > 0) ? x0 - job->halo : 0;
+    const int ly0 = (y0 - job->halo > 0) ? y0 - job->halo : 0;
+    const int lx1 = (x1 + job->halo < width) ? x1 + job->halo : width;
+    const int ly1 = (y1 + job->halo < height) ? y1 + job->halo : height;
+
+    Image region = image_crop(src, lx0, ly0, lx1 - lx0, ly1 - ly0);
+    Image tile_image = image_crop(local, 0, 0, lx1 - lx0, ly1 - ly0);
+    image_copy(&tile_image, &region);
+
+    for (int i = 0; i < job->num_stages; i++) {
+        run_stage(&job->stages[i], &tile_image);
+    }
+
+    Image inner = image_crop(&tile_image, x0 - lx0, y0 - ly0, x1 - x0, y1 - y0);
+    Image out = image_crop(dst, x0, y0, x1 - x0, y1 - y0);
+    image_copy(&out, &inner);
+}
+
+static int run_tiled(const ChainStage *stages, int num_stages, int halo, int planar, Image *image) {
+    const int width = image->width;
+    const int height = image->height;
+    const int channels = image->channels;
+
+    TileJob job;
+    job.stages = stages;
+    job.num_stages = num_stages;
+    job.halo = halo;
+
+    // Equal-sized tiles so none is thinner than the box filters' window.
+    const int tile_size = (TILE_SIZE > 4 * halo) ? TILE_SIZE : 4 * halo;
+    const int tiles_x = (width + tile_size - 1) / tile_size;
+    const int tiles_y = (height + tile_size - 1) / tile_size;
+    job.tile_w = (width + tiles_x - 1) / tiles_x;
+    job.tile_h = (height + tiles_y - 1) / tiles_y;
+
+    const int local_w = job.tile_w + 2 * halo;
+    const int local_h = job.tile_h + 2 * halo;
+    const int num_tiles = tiles_x * tiles_y;
+
+    const ScratchMark mark = scratch_mark();
+    Image out;
+    if (!scratch_image(&out, width, height, channels, 0)) {
+        return 0;
+    }
+
+    const int parallel = use_thread;
+    int failed = 0;
+
+    if (parallel) {
+        // Tiles are the unit of parallelism; the filters run single-threaded inside them.
+        // use_thread is per thread, so every member of the team switches it off for itself.
+        #pragma omp parallel
+        {
+            use_thread = 0;
+            const ScratchMark local_mark = scratch_mark();
+            Image local;
+            const int have_local = scratch_image(&local, local_w, local_h, channels, planar);
+            if (!have_local) {
+                #pragma omp atomic write
+                failed = 1;
+            }
+
+            #pragma omp for schedule(dynamic)
+            for (int t = 0; t < num_tiles; t++) {
+                if (have_local) run_tile(&job, t, image, &out, &local);
+            }
+
+            scratch_release(local_mark);
+            use_thread = 1;
+        }
+    } else {
+        Image local;
+        if (scratch_image(&local, local_w, local_h, channels, planar)) {
+            for (int t = 0; t < num_tiles; t++) {
+                run_tile(&job, t, image, &out, &local);
+            }
+        } else {
+            failed = 1;
+        }
+    }
+
+    if (!failed) {
+        image_copy(image, &out);
+    }
+    scratch_release(mark);
+    return !failed;
+}
+
+/**
+ * In-place variant of run_tiled for --stream: full-width bands from top to
+ * bottom. A band's result is held back until the next band has copied its
+ * upper halo, since those rows must still be the originals; after that only
+ * rows above the next band are written. Working memory is a few bands.
+ */
+static int run_banded(const ChainStage *stages, int num_stages, int halo, int planar, Image *image) {
+    const int width = image->width;
+    const int height = image->height;
+
+    // Equal-height bands, like the tiles, so the last one is not thinner than a box window.
+    const int band_size = (STREAM_BAND_ROWS > 4 * halo) ? STREAM_BAND_ROWS : 4 * halo;
+    const int num_bands = (height + band_size - 1) / band_size;
+    const int band_h = (height + num_bands - 1) / num_bands;
+
+    const ScratchMark mark = scratch_mark();
+    Image local;
+    Image pending;
+    const int have_local = scratch_image(&local, width, band_h + 2 * halo, image->channels, planar);
+    const int have_pending = scratch_image(&pending, width, band_h, image->channels, 0);
+    if (!have_local || !have_pending) {
+        scratch_release(mark);
+        return 0;
+    }
+
+    int pending_y = 0;
+    int pending_rows = 0;
+
+    for (int y0 = 0; y0 < height; y0 += band_h) {
+        const int y1 = (y0 + band_h < height) ? y0 + band_h : height;
+        const int ly0 = (y0 - halo > 0) ? y0 - halo : 0;
+        const int ly1 = (y1 + halo < height) ? y1 + halo : height;
+
+        Image band = image_crop(&local, 0, 0, width, ly1 - ly0);
+        Image source = image_crop(image, 0, ly0, width, ly1 - ly0);
+        image_copy(&band, &source);
+
+        Image done = image_crop(image, 0, pending_y, width, pending_rows);
+        Image held = image_crop(&pending, 0, 0, width, pending_rows);
+        image_copy(&done, &held);
+
+        for (int i = 0; i < num_stages; i++) {
+            run_stage(&stages[i], &band);
+        }
+
+        Image result = image_crop(&band, 0, y0 - ly0, width, y1 - y0);
+        held = image_crop(&pending, 0, 0, width, y1 - y0);
+        image_copy(&held, &result);
+        pending_y = y0;
+        pending_rows = y1 - y0;
+    }
+
+    Image done = image_crop(image, 0, pending_y, width, pending_rows);
+    Image held = image_crop(&pending, 0, 0, width, pending_rows);
+    image_copy(&done, &held);
+
+    scratch_release(mark);
+    return 1;
+}
+
+// Runs stages on a planar copy of the whole image; 0 if the copy cannot be allocated.
+static int run_planar(const ChainStage *stages, int num_stages, Image *image) {
+    const ScratchMark mark = scratch_mark();
+    Image work;
+    if (!scratch_image(&work, image->width, image->height, image->channels, 1)) {
+        return 0;
+    }
+
+    image_copy(&work, image);
+    for (int i = 0; i < num_stages; i++) {
+        run_stage(&stages[i], &work);
+    }
+    image_copy(image, &work);
+
+    scratch_release(mark);
+    return 1;
+}
+
+/**
+ * Splits the plan into segments of stages with a known radius and runs each
+ * segment tile by tile, so a blur -> edge or blur -> contrast chain stays in
+ * cache instead of streaming the full image once per stage. Segments without
+ * a neighbourhood stage, small images and untileable stages run whole-image.
+ * With plan->streaming the segments run in row bands instead (see run_banded).
+ * With plan->planar a segment with a neighbourhood stage runs planar when
+ * every stage in it has a planar kernel.
+ */
+void chain_run(const ChainPlan *plan, Image *image) {
+    int i = 0;
+    while (i < plan->num_stages) {
+        if (stage_radius(&plan->stages[i]) < 0) {
+            run_stage(&plan->stages[i], image);
+            i++;
+            continue;
+        }
+
+        int end = i;
+        int halo = 0;
+        while (end < plan->num_stages && stage_radius(&plan->stages[end]) >= 0) {
+            halo += stage_radius(&plan->stages[end]);
+            end++;
+        }
+
+        int planar = plan->planar && halo > 0 && (image->channels == 3 || image->channels == 4);
+        for (int j = i; j < end && planar; j++) {
+            planar = stage_has_planar(&plan->stages[j]);
+        }
+
+        int done = 0;
+        if (halo > 0 && plan->streaming) {
+            done = run_banded(plan->stages + i, end - i, halo, planar, image);
+        } else if (halo > 0 && (image->width > TILE_SIZE || image->height > TILE_SIZE)) {
+            done = run_tiled(plan->stages + i, end - i, halo, planar, image);
+        } else if (planar) {
+            done = run_planar(plan->stages + i, end - i, image);
+        }
+
+        if (!done) {
+            for (int j = i; j < end; j++) {
+                run_stage(&plan->stages[j], image);
+            }
+        }
+
+        i = end;
+    }
+}
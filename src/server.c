@@ -0,0 +1,546 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700
+#endif
+
+#include "cli.h"
+#include "stb_image.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+int run_server(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+    log_error("--serve is not supported on this platform");
+    fprintf(stderr, "Error: --serve requires Unix domain sockets\n");
+    return ERROR_INVALID_ARGS;
+}
+
+int run_client(int argc, char *argv[]) {
+    (void)argc;
+    (void)argv;
+    log_error("--client is not supported on this platform");
+    fprintf(stderr, "Error: --client requires Unix domain sockets\n");
+    return ERROR_INVALID_ARGS;
+}
+
+#else
+
+#include <errno.h>
+#include <omp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_MAX_REQUEST 65536
+#define SERVER_MAX_ARGS 256
+#define SERVER_READ_TIMEOUT 30  // seconds a client has to send its whole request
+
+typedef struct Job {
+    const ChainPlan *plan;
+    Image *image;
+    int done;
+    struct Job *next;
+} Job;
+
+// An accepted client; run_server cuts the ones still reading their request when it stops.
+typedef struct Connection {
+    int fd;
+    int reading;
+    int cut;
+    struct Connection *prev;
+    struct Connection *next;
+} Connection;
+
+// Filters run on one long-lived executor thread so its OpenMP team stays warm
+// between requests; connection threads only do socket I/O, decoding and encoding.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t finished;
+    Job *head;
+    Job *tail;
+    Connection *open;
+    int connections;
+    int stopping;
+} Server;
+
+static Server server = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, NULL, 0, 0
+};
+
+static volatile sig_atomic_t shutdown_requested = 0;
+
+static void on_shutdown_signal(int sig) {
+    (void)sig;
+    shutdown_requested = 1;
+}
+
+static void *executor(void *arg) {
+    (void)arg;
+    omp_set_num_threads(omp_get_num_procs());
+    numa_bind_threads();
+
+    pthread_mutex_lock(&server.lock);
+    for (;;) {
+        while (!server.head && !server.stopping) {
+            pthread_cond_wait(&server.queued, &server.lock);
+        }
+        if (!server.head) break;
+
+        Job *job = server.head;
+        server.head = job->next;
+        if (!server.head) server.tail = NULL;
+        pthread_mutex_unlock(&server.lock);
+
+        chain_run(job->plan, job->image);
+
+        pthread_mutex_lock(&server.lock);
+        job->done = 1;
+        pthread_cond_broadcast(&server.finished);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    // Scratch arenas are thread-local, this thread's and its team's would leak on exit.
+    scratch_free();
+    #pragma omp parallel
+    scratch_free();
+    return NULL;
+}
+
+static void run_job(Job *job) {
+    job->done = 0;
+    job->next = NULL;
+
+    pthread_mutex_lock(&server.lock);
+    if (server.tail) server.tail->next = job;
+    else server.head = job;
+    server.tail = job;
+    pthread_cond_signal(&server.queued);
+
+    while (!job->done) {
+        pthread_cond_wait(&server.finished, &server.lock);
+    }
+    pthread_mutex_unlock(&server.lock);
+}
+
+// args: [0] program name, [1] input, [2] output, then the filter chain and
+// optionally --fixed. The mode is per request, so the global use_fixed_point
+// is left alone.
+static int handle_request(int argc, char *argv[]) {
+    if (argc < 3 || !is_valid_expression(argv[1]) || !is_valid_expression(argv[2])) {
+        log_error("Rejected request: expected input.png|jpg output.png|jpg [filters...]");
+        return ERROR_INVALID_ARGS;
+    }
+
+    ChainStep *steps = (ChainStep *)malloc(argc * sizeof(ChainStep));
+    if (!steps) {
+        log_error("Failed to allocate filter chain (%d entries)", argc);
+        return ERROR_IO;
+    }
+
+    int num_steps = 0;
+    int fixed_point = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--fixed") == 0) {
+            fixed_point = 1;
+            continue;
+        }
+
+        int status = parse_filter(argc, argv, &i, &steps[num_steps], 0);
+        if (status != ERROR_SUCCESS) {
+            free(steps);
+            return status;
+        }
+        num_steps++;
+    }
+
+    InputFile input;
+    if (!input_open(&input, argv[1])) {
+        log_error("Cannot open file: %s", argv[1]);
+        free(steps);
+        return ERROR_IO;
+    }
+
+    Image image;
+    const int decoded = image_decode(&image, input.data, input.size);
+    input_close(&input);
+    if (!decoded) {
+        log_error("Failed to load image %s. Reason: %s", argv[1], stbi_failure_reason());
+        free(steps);
+        return ERROR_IO;
+    }
+    log_info("Image loaded: %s, %dx%d, %d channels", argv[1], image.width, image.height, image.channels);
+
+    ChainPlan plan;
+    if (!chain_plan(&plan, steps, num_steps, image.channels, fixed_point)) {
+        log_error("Failed to plan filter chain of %d filters", num_steps);
+        image_free(&image);
+        free(steps);
+        return ERROR_IO;
+    }
+
+    Job job;
+    job.plan = &plan;
+    job.image = &image;
+    run_job(&job);
+
+    int status = save_image(argv[2], &image);
+
+    chain_free(&plan);
+    image_free(&image);
+    free(steps);
+    return status;
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += written;
+        size -= written;
+    }
+    return 1;
+}
+
+/**
+ * Reads until the peer shuts down its side; the request must fit in
+ * capacity and arrive within SERVER_READ_TIMEOUT (SO_RCVTIMEO).
+ */
+static int read_all(int fd, char *buffer, size_t capacity, size_t *size) {
+    *size = 0;
+    for (;;) {
+        if (*size == capacity) return 0;
+
+        ssize_t got = read(fd, buffer + *size, capacity - *size);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                log_error("Request not complete after %d seconds", SERVER_READ_TIMEOUT);
+            }
+            return 0;
+        }
+        if (got == 0) return 1;
+        *size += got;
+    }
+}
+
+static const char *status_message(int status) {
+    switch (status) {
+        case ERROR_SUCCESS: return "OK";
+        case ERROR_IO: return "I/O error";
+        case ERROR_INVALID_ARGS: return "invalid arguments";
+        default: return "error";
+    }
+}
+
+/**
+ * One request per connection: the client sends NUL-terminated arguments
+ * (input, output, filters..., optionally --fixed) and closes its write
+ * side; the server answers with one line "<ErrorCode> <message>" and
+ * closes the connection.
+ */
+static void *serve_connection(void *arg) {
+    Connection *connection = (Connection *)arg;
+    const int fd = connection->fd;
+    char *request = (char *)malloc(SERVER_MAX_REQUEST);
+    char *args[SERVER_MAX_ARGS];
+    int num_args = 0;
+    int status = ERROR_INVALID_ARGS;
+    size_t size = 0;
+
+    const int received = request && read_all(fd, request, SERVER_MAX_REQUEST, &size);
+
+    pthread_mutex_lock(&server.lock);
+    connection->reading = 0;
+    const int cut = connection->cut;
+    pthread_mutex_unlock(&server.lock);
+
+    if (!request) {
+        log_error("Failed to allocate request buffer");
+        status = ERROR_IO;
+    } else if (cut) {
+        log_info("Dropped a request still being read at shutdown (%zu bytes)", size);
+        status = ERROR_IO;
+    } else if (received && size > 0 && request[size - 1] == '\0') {
+        size_t pos = 0;
+        args[num_args++] = "img_ed";
+        while (pos < size && num_args < SERVER_MAX_ARGS) {
+            args[num_args++] = request + pos;
+            pos += strlen(request + pos) + 1;
+        }
+
+        if (pos < size) {
+            log_error("Rejected request with more than %d arguments", SERVER_MAX_ARGS - 1);
+        } else {
+            status = handle_request(num_args, args);
+        }
+    } else {
+        log_error("Malformed request (%zu bytes)", size);
+    }
+
+    char response[64];
+    int len = snprintf(response, sizeof(response), "%d %s\n", status, status_message(status));
+    write_all(fd, response, len);
+    close(fd);
+    free(request);
+
+    pthread_mutex_lock(&server.lock);
+    if (connection->prev) connection->prev->next = connection->next;
+    else server.open = connection->next;
+    if (connection->next) connection->next->prev = connection->prev;
+    free(connection);
+    server.connections--;
+    pthread_cond_broadcast(&server.finished);
+    pthread_mutex_unlock(&server.lock);
+    return NULL;
+}
+
+static int socket_address(struct sockaddr_un *addr, const char *path) {
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        log_error("Socket path too long: %s", path);
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return 0;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+// A socket file nobody is accepting on is left over from a crashed server.
+static int remove_stale_socket(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (stat(addr->sun_path, &st) != 0) return 1;
+    if (!S_ISSOCK(st.st_mode)) return 0;
+
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) return 0;
+    int in_use = connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(probe);
+
+    return !in_use && unlink(addr->sun_path) == 0;
+}
+
+/**
+ * img_ed --serve <socket>
+ *
+ * Long-lived worker: the log, the OpenMP team and the filter table are set
+ * up once and every connection is a job. Clients are served concurrently;
+ * the filter chains themselves run one at a time on the warm team, which
+ * already uses every core. SIGINT or SIGTERM stop accepting, drop clients
+ * that have not sent a whole request yet, let in-flight jobs finish and
+ * remove the socket.
+ */
+int run_server(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return ERROR_INVALID_ARGS;
+    }
+
+    const char *path = argv[2];
+    struct sockaddr_un addr;
+    if (!socket_address(&addr, path)) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    if (!remove_stale_socket(&addr)) {
+        log_error("Socket path is in use: %s", path);
+        fprintf(stderr, "Error: %s is in use\n", path);
+        return ERROR_IO;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (const struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        log_error("Cannot listen on %s: %s", path, strerror(errno));
+        fprintf(stderr, "Error: could not listen on %s: %s\n", path, strerror(errno));
+        if (listener >= 0) close(listener);
+        return ERROR_IO;
+    }
+
+    // The shutdown signals stay blocked everywhere except inside pselect(),
+    // so worker threads never see them and the main loop cannot miss one.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_shutdown_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t blocked, wait_mask;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &wait_mask);
+    sigdelset(&wait_mask, SIGINT);
+    sigdelset(&wait_mask, SIGTERM);
+
+    pthread_t executor_thread;
+    if (pthread_create(&executor_thread, NULL, executor, NULL) != 0) {
+        log_error("Failed to start executor thread");
+        fprintf(stderr, "Error: failed to start executor thread\n");
+        close(listener);
+        unlink(path);
+        return ERROR_IO;
+    }
+
+    pthread_attr_t detached;
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+
+    printf("Serving on %s\n", path);
+    fflush(stdout);
+    log_info("Serving on %s", path);
+
+    int status = ERROR_SUCCESS;
+    while (!shutdown_requested) {
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(listener, &ready);
+        if (pselect(listener + 1, &ready, NULL, NULL, NULL, &wait_mask) < 0) {
+            if (errno == EINTR) continue;
+            log_error("Waiting for connections failed: %s", strerror(errno));
+            status = ERROR_IO;
+            break;
+        }
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                log_error("accept failed: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        struct timeval timeout = {SERVER_READ_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        Connection *connection = (Connection *)malloc(sizeof(Connection));
+        if (!connection) {
+            log_error("Failed to allocate connection");
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->reading = 1;
+        connection->cut = 0;
+        connection->prev = NULL;
+
+        pthread_mutex_lock(&server.lock);
+        connection->next = server.open;
+        if (server.open) server.open->prev = connection;
+        server.open = connection;
+        server.connections++;
+        pthread_mutex_unlock(&server.lock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, &detached, serve_connection, connection) != 0) {
+            log_error("Failed to start connection thread");
+            close(fd);
+            pthread_mutex_lock(&server.lock);
+            server.open = connection->next;
+            if (server.open) server.open->prev = NULL;
+            server.connections--;
+            pthread_mutex_unlock(&server.lock);
+            free(connection);
+        }
+    }
+
+    log_info("Shutting down, waiting for %d connections", server.connections);
+    close(listener);
+    unlink(path);
+
+    // An idle client would otherwise keep the daemon up until it closes its socket.
+    pthread_mutex_lock(&server.lock);
+    for (Connection *connection = server.open; connection; connection = connection->next) {
+        if (connection->reading) {
+            connection->cut = 1;
+            shutdown(connection->fd, SHUT_RD);
+        }
+    }
+    while (server.connections > 0) {
+        pthread_cond_wait(&server.finished, &server.lock);
+    }
+    server.stopping = 1;
+    pthread_cond_signal(&server.queued);
+    pthread_mutex_unlock(&server.lock);
+
+    pthread_join(executor_thread, NULL);
+    pthread_attr_destroy(&detached);
+
+    printf("Server on %s stopped\n", path);
+    log_info("Server on %s stopped", path);
+    return status;
+}
+
+// The server resolves paths in its own working directory, so send absolute ones.
+static int send_path(int fd, const char *path) {
+    if (path[0] != '/') {
+        char cwd[4096];
+        if (!getcwd(cwd, sizeof(cwd))) return 0;
+        if (!write_all(fd, cwd, strlen(cwd)) || !write_all(fd, "/", 1)) return 0;
+    }
+    return write_all(fd, path, strlen(path) + 1);
+}
+
+/**
+ * img_ed --client <socket> input.jpg output.jpg [filters...] [--fixed]
+ *
+ * Sends one job to a running --serve instance, prints its reply and returns
+ * the server's ErrorCode.
+ */
+int run_client(int argc, char *argv[]) {
+    if (argc < 5) {
+        usage(argv[0]);
+        return ERROR_INVALID_ARGS;
+    }
+
+    struct sockaddr_un addr;
+    if (!socket_address(&addr, argv[2])) {
+        return ERROR_INVALID_ARGS;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        log_error("Cannot connect to %s: %s", argv[2], strerror(errno));
+        fprintf(stderr, "Error: could not connect to %s: %s\n", argv[2], strerror(errno));
+        if (fd >= 0) close(fd);
+        return ERROR_IO;
+    }
+
+    int sent = send_path(fd, argv[3]) && send_path(fd, argv[4]);
+    for (int i = 5; i < argc && sent; i++) {
+        sent = write_all(fd, argv[i], strlen(argv[i]) + 1);
+    }
+
+    char response[256];
+    size_t size = 0;
+    if (!sent || shutdown(fd, SHUT_WR) != 0 || !read_all(fd, response, sizeof(response) - 1, &size) || size == 0) {
+        log_error("No response from %s", argv[2]);
+        fprintf(stderr, "Error: no response from %s\n", argv[2]);
+        close(fd);
+        return ERROR_IO;
+    }
+    close(fd);
+
+    response[size] = '\0';
+    printf("%s", response);
+    log_info("Server replied: %.*s", (int)strcspn(response, "\n"), response);
+    return (int)strtol(response, NULL, 10);
+}
+
+#endif